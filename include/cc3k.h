@@ -12,16 +12,89 @@ extern "C" {
 #endif
 
 #define CC3K_BUFFER_SIZE 1500+200
+
+/**
+ * @brief Embed the SPI buffers in the driver structure
+ *
+ * Set to 0 when every driver is given a buffer pool, to save the space.
+ */
+#ifndef CC3K_STATIC_BUFFERS
+#define CC3K_STATIC_BUFFERS 1
+#endif
+
+/** @brief Bytes clocked in by the first transaction of every SPI read */
+#define CC3K_READ_HEADER_SIZE 10
+
+/** @brief Default time allowed from power up to the simple link start response */
+#ifndef CC3K_BOOT_TIMEOUT_MS
+#define CC3K_BOOT_TIMEOUT_MS 2000
+#endif
+/** @brief Default time allowed for the chip to answer a command */
+#ifndef CC3K_COMMAND_TIMEOUT_MS
+#define CC3K_COMMAND_TIMEOUT_MS 2000
+#endif
+
+/** @brief Time the chip may block in a select command */
+#define CC3K_SELECT_TIMEOUT_MS 1000
+
+/** @brief Time the chip may take to give up on a TCP connect */
+#ifndef CC3K_CONNECT_TIMEOUT_MS
+#define CC3K_CONNECT_TIMEOUT_MS 20000
+#endif
+
+/**
+ * @brief Time allowed for a warm started chip to answer before it is power cycled
+ *
+ * Long enough for a select the previous run left on the chip to return.
+ */
+#ifndef CC3K_WARM_TIMEOUT_MS
+#define CC3K_WARM_TIMEOUT_MS (CC3K_SELECT_TIMEOUT_MS + 500)
+#endif
+
+/** @brief Marks a filled in driver snapshot */
+#define CC3K_SNAPSHOT_MAGIC 0x534b3343
+
+/** @brief How long a refused caller keeps lower priority traffic off the link */
+#ifndef CC3K_PRIORITY_HOLD_MS
+#define CC3K_PRIORITY_HOLD_MS 20
+#endif
+
+/** @brief Time a class can be held off before it is let through anyway */
+#ifndef CC3K_PRIORITY_AGING_MS
+#define CC3K_PRIORITY_AGING_MS 200
+#endif
+
 #define CC3K_SSID_MAX 32
 #define CC3K_KEY_MAX 64
+#define CC3K_HOSTNAME_MAX 230
+
+/** @brief Largest payload accepted by cc3k_send and cc3k_sendto */
+#define CC3K_SEND_MAX 1460
 
 #include <cc3k_type.h>
 #include <cc3k_packet.h>
 #include <cc3k_command.h>
 #include <cc3k_event.h>
+#include <cc3k_backoff.h>
+#include <cc3k_pool.h>
+#include <cc3k_stats.h>
+#include <cc3k_ping.h>
+#include <cc3k_identity.h>
+#include <cc3k_boot.h>
 #include <cc3k_socket.h>
 
 
+/**
+ * @brief Traffic classes competing for the SPI link, highest first
+ */
+typedef enum _cc3k_priority_t
+{
+  CC3K_PRIORITY_CONTROL,    // Bring-up, association, socket setup and recovery
+  CC3K_PRIORITY_DATA,       // Application sends and receives
+  CC3K_PRIORITY_BACKGROUND, // Select and status polling
+  CC3K_PRIORITY_CLASSES
+} cc3k_priority_t;
+
 /**
  * @brief Driver SPI protocol state
  */
@@ -40,6 +113,12 @@ typedef enum _cc3k_state_t
   CC3K_STATE_DATA,              // Performing SPI transaction, and waiting for a response
   CC3K_STATE_DATA_RX_REQUEST,   // Receiving a data frame
   CC3K_STATE_DATA_RX,           // Receiving a data frame
+  CC3K_STATE_POWER_OFF,         // Chip held disabled before power up
+  CC3K_STATE_POWER_ON,          // Chip enabled, waiting for it to settle
+  CC3K_STATE_WAIT_READY,        // Waiting for the chip to pull IRQ low after power up
+  CC3K_STATE_WAIT_CS,           // IRQ is low, waiting before asserting /CS
+  CC3K_STATE_SIMPLE_LINK_FIRST, // First bytes of simple link start sent, waiting to send the rest
+  CC3K_STATE_ERROR,             // Boot failed, see boot_status
 } cc3k_state_t;
 
 /**
@@ -62,10 +141,66 @@ typedef enum _cc3k_link_state_t
 #ifdef CC3K_DEBUG
 static const char *state_names[] = {
   "INIT", "SIMPLE_LINK_START", "COMMAND_REQUEST", "SEND_COMMAND", "COMMAND", "IDLE",
-  "READ_HEADER", "READ_PAYLOAD", "EVENT", "DATA_REQUEST", "DATA", "DATA_RX_REQUEST", "DATA_RX"
+  "READ_HEADER", "READ_PAYLOAD", "EVENT", "DATA_REQUEST", "DATA", "DATA_RX_REQUEST", "DATA_RX",
+  "POWER_OFF", "POWER_ON", "WAIT_READY", "WAIT_CS", "SIMPLE_LINK_FIRST", "ERROR"
 };
 #endif
 
+/**
+ * @brief IP Configuration structure
+ */
+typedef struct _cc3k_ipconfig_t
+{
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t default_gateway;
+  uint32_t dhcp_server;
+  uint32_t dns_server;
+} cc3k_ipconfig_t;
+
+/**
+ * @brief Driver state kept across a host reset
+ *
+ * Taken with cc3k_snapshot_save and stored where it survives the reset,
+ * then passed to cc3k_init_warm to carry on with a chip that stayed powered.
+ */
+typedef struct _cc3k_snapshot_t
+{
+  uint32_t magic;
+  /** @brief Size of the snapshot, so a layout change is not mistaken for a valid one */
+  uint16_t size;
+  uint16_t buffer_size;
+  uint8_t buffers;
+  uint8_t dhcp_complete;
+  uint32_t wlan_status;
+  uint32_t event_mask;
+  cc3k_ipconfig_t ipconfig;
+  /** @brief Descriptors open on the chip, one bit each */
+  uint32_t sockets;
+  /** @brief Covers every field above */
+  uint32_t checksum;
+} cc3k_snapshot_t;
+
+/**
+ * @brief Network stack timers, in seconds
+ *
+ * Zero disables a timer. Other values below CC3K_NETAPP_TIMER_MIN
+ * are raised to the minimum the chip accepts.
+ */
+typedef struct _cc3k_netapp_timers_t
+{
+  /** @brief DHCP lease time requested from the server */
+  uint32_t dhcp;
+  /** @brief ARP cache refresh */
+  uint32_t arp;
+  /** @brief TCP keepalive interval */
+  uint32_t keepalive;
+  /** @brief Close TCP sockets idle for this long */
+  uint32_t inactivity;
+} cc3k_netapp_timers_t;
+
+#define CC3K_NETAPP_TIMER_MIN 20
+
 /**
  * @brief Driver configuration
  *
@@ -94,9 +229,118 @@ typedef struct _cc3k_config_t
   void (*dataCallback)();
   void (*transitionCallback)(cc3k_state_t from, cc3k_state_t to);
 
+  /**
+   * @brief Speculative SPI read length
+   *
+   * Number of bytes clocked in by the first read transaction. Frames no
+   * longer than this complete in a single SPI transfer, anything larger
+   * is finished with a second transfer. Zero reads only the minimal
+   * CC3K_READ_HEADER_SIZE bytes, so every frame takes two transfers.
+   */
+  uint16_t speculative_read;
+
+  /** @brief Time allowed for the chip to boot, zero selects CC3K_BOOT_TIMEOUT_MS */
+  uint32_t boot_timeout_ms;
+
+  /**
+   * @brief Time allowed for the chip to answer a command
+   *
+   * Zero selects CC3K_COMMAND_TIMEOUT_MS. Select commands get
+   * CC3K_SELECT_TIMEOUT_MS on top.
+   */
+  uint32_t command_timeout_ms;
+
+  /**
+   * @brief Unsolicited events to suppress, applied during bring-up
+   *
+   * Bitwise OR of CC3K_EVENT_* opcodes, see CC3K_EVENT_MASK_ALL.
+   * Zero leaves the chip reporting every event. Events the driver needs
+   * are never masked, see cc3k_event_mask_filter.
+   */
+  uint32_t event_mask;
+
+  /**
+   * @brief Static address to use, or NULL for DHCP
+   *
+   * A lease saved from a previous cc3k_get_ipconfig can be passed here to
+   * skip the DHCP exchange after association. The address is stored on
+   * the chip only if the chip reports a different one, and takes effect
+   * from its next power up.
+   */
+  const cc3k_ipconfig_t *static_ip;
+
+  /** @brief Network stack timers to program during bring-up, or NULL for chip defaults */
+  const cc3k_netapp_timers_t *timers;
+
+  /** @brief Extra setup commands to run after the driver's own bring-up steps */
+  const cc3k_boot_step_t *boot_script;
+  uint8_t boot_script_length;
+
+  /**
+   * @brief Block until the driver has made progress
+   *
+   * Used by the BSD socket layer while waiting on the chip. Either sleep
+   * on a semaphore given from another task running cc3k_loop, or call
+   * cc3k_loop directly.
+   */
+  void (*wait)(void);
+
+  /** @brief Optional random number source for retry jitter */
+  uint32_t (*random)(void);
+
+  /** @brief Backoff between WLAN association attempts */
+  cc3k_backoff_config_t wlan_backoff;
+  /** @brief Backoff between TCP connect attempts on a socket */
+  cc3k_backoff_config_t socket_backoff;
+
+  /** @brief Periodic ping of the default gateway to watch link latency */
+  cc3k_ping_config_t ping;
+
+  /**
+   * @brief Identity cache kept by the application, or NULL
+   *
+   * Should hold the blob saved after a previous boot, or anything else
+   * the first time. If the blob does not check out, the identity is read
+   * from the chip during bring-up and written back to it.
+   */
+  cc3k_identity_t *identity;
+
+  /** @brief Called once a freshly read identity has been written to the cache */
+  void (*identity_save)(cc3k_t *driver, const cc3k_identity_t *identity);
+
+  /**
+   * @brief Issue the receive for the first readable socket from the select response
+   *
+   * Saves a loop pass of latency per packet. The receive window callback
+   * is then called in interrupt context.
+   */
+  uint8_t chain_recv;
+
+  /**
+   * @brief Bytes a socket may read back to back without another select
+   *
+   * While a receive comes back full, the next one is issued straight
+   * away until this many bytes have been read. Zero disables draining.
+   * Only sockets that are nonblocking or have a receive timeout are
+   * drained; a blocking receive would hold the chip if the socket
+   * turned out to be empty.
+   */
+  uint32_t drain_budget;
+
+  /**
+   * @brief Optional pool to borrow the SPI buffers from
+   *
+   * Blocks must be at least CC3K_BUFFER_SIZE bytes. The SPI link
+   * carries one frame at a time, so the driver itself holds one block
+   * per direction; the rest back frames loaned out with cc3k_rx_loan.
+   * When NULL the buffers embedded in the driver structure are used,
+   * and received frames cannot be loaned out.
+   */
+  cc3k_pool_t *pool;
+
 } cc3k_config_t;
 
-typedef struct _cc3k_stats_t
+struct _cc3k_stats_t
 {
   /** @brief Number of times a wifi connection attempt has been made */
   uint16_t wifi_connections;
@@ -107,23 +351,64 @@ typedef struct _cc3k_stats_t
   uint32_t commands;
   uint32_t events;
   uint32_t unsolicited;
-  uint32_t tx;
-  uint32_t rx;
-  uint32_t bytes_tx;
-  uint32_t bytes_rx;
-} cc3k_stats_t;
-
-/**
- * @brief IP Configuration structure
- */
-typedef struct _cc3k_ipconfig_t
-{
-  uint32_t ip;
-  uint32_t netmask;
-  uint32_t default_gateway;
-  uint32_t dhcp_server;
-  uint32_t dns_server;
-} cc3k_ipconfig_t;
+  uint64_t tx;
+  uint64_t rx;
+  uint64_t bytes_tx;
+  uint64_t bytes_rx;
+  /** @brief Data frames received for a descriptor with no socket */
+  uint32_t rx_drops;
+  /** @brief Number of WLAN association attempts made after a failure */
+  uint32_t wlan_retries;
+  /** @brief Number of socket connect attempts made after a failure */
+  uint32_t socket_retries;
+  /** @brief Total milliseconds of backoff scheduled across all retries */
+  uint32_t backoff_ms;
+  /** @brief Unsolicited keepalive events received */
+  uint32_t keepalive_events;
+  /** @brief Unsolicited ping report events received */
+  uint32_t ping_report_events;
+  /** @brief Unsolicited free buffer events received */
+  uint32_t free_buffer_events;
+  /** @brief Milliseconds from power up until the bring-up sequence completed */
+  uint32_t boot_time_ms;
+  /** @brief Frames received with a single SPI transfer */
+  uint32_t rx_single_transfer;
+  /** @brief Frames that needed a second SPI transfer for the payload */
+  uint32_t rx_split_transfer;
+
+  /** @brief Throughput over the last CC3K_RATE_WINDOW_MS */
+  uint32_t tx_bytes_per_sec;
+  uint32_t rx_bytes_per_sec;
+  uint32_t tx_frames_per_sec;
+  uint32_t rx_frames_per_sec;
+
+  /** @brief Stalls recovered by reading a frame whose interrupt was missed */
+  uint32_t recover_rereads;
+  /** @brief Stalls recovered by abandoning the command and resetting the SPI state */
+  uint32_t recover_resyncs;
+  /** @brief Stalls recovered by power cycling the chip */
+  uint32_t recover_power_cycles;
+  /** @brief Receives issued directly from a select response */
+  uint32_t chained_recvs;
+  /** @brief Receives issued straight after a full read */
+  uint32_t drain_recvs;
+  /** @brief Sends refused because every chip buffer was in use */
+  uint32_t tx_no_buffer;
+  /** @brief Sends made while a command response was outstanding */
+  uint32_t tx_interleaved;
+  /** @brief Sends refused to make way for a higher priority class */
+  uint32_t priority_deferred;
+  /** @brief Sends let through ahead of a higher priority class after waiting too long */
+  uint32_t priority_aged;
+  /** @brief Receive buffers handed to the application */
+  uint32_t rx_loans;
+  /** @brief Loans refused because the pool was empty */
+  uint32_t rx_loan_failures;
+  /** @brief Starts that carried on with a running chip */
+  uint32_t warm_restarts;
+  /** @brief Warm starts that fell back to a power cycle */
+  uint32_t warm_fallbacks;
+};
 
 /**
  * @brief Driver Context
@@ -135,7 +420,29 @@ struct _cc3k_t
   cc3k_ipconfig_t ipconfig;
   uint8_t dhcp_complete;
 
+  /** @brief Static address in use instead of DHCP */
+  cc3k_ipconfig_t static_ip;
+  uint8_t static_ip_enabled;
+  /** @brief Set once the chip has reported the static address as its own */
+  uint8_t static_ip_active;
+  /** @brief Set when the chip came up with another address and needs the static one stored */
+  uint8_t static_ip_write;
+
+  /** @brief Chip identity, see cc3k_get_identity */
+  cc3k_identity_t identity;
+  /** @brief CC3K_IDENTITY_* parts still to be read */
+  uint8_t identity_pending;
+  /** @brief Arguments for the bring-up NVMEM read */
+  cc3k_command_nvmem_read_t nvmem_read;
+
+  /** @brief Arguments for the bring-up NETAPP timers command */
+  cc3k_command_netapp_set_timers_t netapp_timers;
+
   cc3k_stats_t stats;
+  /** @brief Bumped on entry to every interrupt handler, see cc3k_stats_snapshot */
+  volatile uint32_t stats_seq;
+  /** @brief Throughput samples */
+  cc3k_rate_window_t rate_window;
   
   /** @brief Socket Manager context */
   cc3k_socket_manager_t socket_manager;
@@ -163,21 +470,90 @@ struct _cc3k_t
     * @brief Pointer to SPI Packet buffer
     * Only one buffer should be required, as CC3000 SPI is simplex
     */ 
-	uint8_t packet_tx_buffer[CC3K_BUFFER_SIZE];
-	uint8_t packet_rx_buffer[CC3K_BUFFER_SIZE];
+	uint8_t *packet_tx_buffer;
+	uint8_t *packet_rx_buffer;
+
+#if CC3K_STATIC_BUFFERS
+	uint8_t packet_tx_storage[CC3K_BUFFER_SIZE];
+	uint8_t packet_rx_storage[CC3K_BUFFER_SIZE];
+#endif
 
   uint16_t packet_tx_buffer_length;
+  /** @brief Bytes clocked into the receive buffer by the current read */
   uint16_t packet_rx_buffer_length;
 
+  /** @brief Set while a received frame is being handed to a socket */
+  uint8_t rx_loanable;
+  /** @brief Pool blocks on loan to the application, one bit each */
+  volatile uint32_t rx_loaned;
+
   uint32_t last_time_ms;
   uint32_t last_update;
 
+  /** @brief Milliseconds remaining in the current boot step */
+  uint32_t boot_timer;
+  /** @brief Milliseconds elapsed since the boot sequence started */
+  uint32_t boot_elapsed;
+  /** @brief Result of the boot sequence */
+  cc3k_status_t boot_status;
+
+  /** @brief Bring-up command sequence */
+  cc3k_boot_step_t boot_script[CC3K_BOOT_STEPS_MAX];
+  uint8_t boot_steps;
+  /** @brief Index of the bring-up step awaiting a response */
+  uint8_t boot_step;
+  /** @brief Set once the bring-up sequence has completed */
+  uint8_t ready;
+  /** @brief Set while a warm start waits for the chip to answer */
+  uint8_t warm;
+
+  /** @brief Milliseconds each class keeps lower classes off the link */
+  uint16_t priority_hold[CC3K_PRIORITY_CLASSES];
+  /** @brief Milliseconds each class has been waiting for the link */
+  uint16_t priority_wait[CC3K_PRIORITY_CLASSES];
+
+  /** @brief Milliseconds the current command or transfer has been outstanding */
+  uint32_t watchdog_timer;
+  /** @brief Command being timed */
+  cc3k_command_t watchdog_command;
+  /** @brief Frames received when the watchdog last looked */
+  uint32_t watchdog_events;
+  /** @brief Recovery steps taken since the chip last sent anything */
+  uint8_t watchdog_level;
+  /** @brief Set once a resync has been put off for a transfer in flight */
+  uint8_t watchdog_deferred;
+
   /** @brief Number of buffers available on the chip */
   uint8_t buffers;
+  /** @brief Size of each chip buffer in bytes */
+  uint16_t buffer_size;
+  /** @brief Chip buffers not holding an outgoing data frame */
+  uint8_t buffers_free;
 
   // TODO: This doesn't need to be 32 bit
   uint32_t wlan_status;
 
+  /** @brief Result of the last host name lookup */
+  uint8_t dns_pending;
+  int32_t dns_result;
+  uint32_t dns_ip;
+
+  /** @brief Result of the last socket option read */
+  uint8_t sockopt_pending;
+  int8_t sockopt_status;
+  uint32_t sockopt_value;
+
+  /** @brief Unsolicited events currently suppressed on the chip */
+  uint32_t event_mask;
+
+  /** @brief Delay before the next WLAN association attempt */
+  cc3k_backoff_t wlan_backoff;
+
+  /** @brief Gateway ping monitor */
+  cc3k_ping_t ping;
+  /** @brief State of the fallback jitter generator */
+  uint32_t random_state;
+
   // For now, store the SSID and key in the driver structure. Switch to profiles or store information in user EEPROM
   cc3k_security_type_t security_type;
   char ssid[CC3K_SSID_MAX];
@@ -188,9 +564,94 @@ struct _cc3k_t
 
 /**
  * @brief Initialize the driver
+ *
+ * Powers up the chip and blocks until the simple link start command has
+ * been sent, or the boot timeout expires.
  */
 cc3k_status_t cc3k_init(cc3k_t *driver, cc3k_config_t *config);
 
+/**
+ * @brief Initialize the driver without blocking
+ *
+ * Starts the power up sequence and returns immediately. Each boot step is
+ * advanced by cc3k_loop as its delay expires, followed by the bring-up
+ * command sequence. Use cc3k_boot_status to find out when the driver
+ * is ready.
+ */
+cc3k_status_t cc3k_init_async(cc3k_t *driver, cc3k_config_t *config);
+
+/**
+ * @brief Initialize the driver against a chip that stayed powered
+ *
+ * Used after a host reset that left the chip running, with the enable pin
+ * held at its level. The snapshot is restored and the chip is asked for
+ * its status instead of being power cycled. If the snapshot does not
+ * check out, or the chip does not answer within CC3K_WARM_TIMEOUT_MS,
+ * the driver falls back to the cold start of cc3k_init_async.
+ *
+ * Descriptors open in the snapshot are closed once the driver is ready,
+ * and the sockets are opened again as usual.
+ */
+cc3k_status_t cc3k_init_warm(cc3k_t *driver, cc3k_config_t *config, const cc3k_snapshot_t *snapshot);
+
+/**
+ * @brief Save the state a warm start needs
+ *
+ * @return CC3K_INVALID_STATE until the bring-up sequence has completed
+ */
+cc3k_status_t cc3k_snapshot_save(cc3k_t *driver, cc3k_snapshot_t *snapshot);
+
+/**
+ * @brief Check the magic, size and checksum of a snapshot
+ *
+ * @return 1 if the snapshot can be used
+ */
+int cc3k_snapshot_valid(const cc3k_snapshot_t *snapshot);
+
+/**
+ * @brief FNV-1a hash, used to seal state kept by the application
+ */
+uint32_t cc3k_checksum(const void *data, uint32_t length);
+
+/**
+ * @brief Return the SPI buffers to the configured pool
+ *
+ * Only needed when the driver is being discarded. The driver must
+ * be initialized again before it is used.
+ */
+cc3k_status_t cc3k_release_buffers(cc3k_t *driver);
+
+/**
+ * @brief Keep a received frame after the receive callback returns
+ *
+ * Called from a socket receive callback with the data pointer it was
+ * given. The receive buffer holding the frame is handed to the
+ * application, and the driver carries on with a fresh block from the
+ * configured pool. The data stays valid until cc3k_rx_release.
+ *
+ * @return CC3K_OK if the frame now belongs to the application,
+ *         CC3K_INVALID if there is no pool or the pool is empty,
+ *         in which case the data must be copied as usual
+ */
+cc3k_status_t cc3k_rx_loan(cc3k_t *driver, uint8_t *data);
+
+/**
+ * @brief Return a frame taken with cc3k_rx_loan to the pool
+ *
+ * @return CC3K_INVALID_STATE if the block is not on loan, which covers
+ *         the buffers the driver is using and a second release
+ */
+cc3k_status_t cc3k_rx_release(cc3k_t *driver, uint8_t *data);
+
+/**
+ * @brief Get the progress of the boot sequence
+ *
+ * @return CC3K_BUSY while booting, CC3K_OK once the bring-up
+ *         sequence has completed,
+ *         or CC3K_TIMEOUT if the chip did not respond in time
+ */
+cc3k_status_t cc3k_boot_status(cc3k_t *driver);
+
 /**
  * @brief Set the wlan access point
  */
@@ -215,9 +676,30 @@ cc3k_status_t cc3k_interrupt(cc3k_t *driver);
 
 /**
  * @brief Send an asynchronous command to the chip
+ *
+ * The traffic class is chosen from the opcode, see cc3k_command_priority.
  */
 cc3k_status_t cc3k_send_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t args_length);
 
+/**
+ * @brief Send an asynchronous command in a given traffic class
+ *
+ * Returns CC3K_BUSY while a higher class is waiting for the link, unless
+ * this class has already been waiting for CC3K_PRIORITY_AGING_MS.
+ */
+cc3k_status_t cc3k_send_command_priority(cc3k_t *driver, cc3k_priority_t priority, uint16_t opcode, uint8_t *arg, uint8_t args_length);
+
+/**
+ * @brief Send a data frame in a given traffic class
+ */
+cc3k_status_t cc3k_send_data_priority(cc3k_t *driver, cc3k_priority_t priority, uint8_t opcode, uint8_t *arg, uint8_t args_length,
+  uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length);
+
+/**
+ * @brief Default traffic class of a command
+ */
+cc3k_priority_t cc3k_command_priority(uint16_t opcode);
+
 /**
  * @brief Create a command packet in the transmit buffer
  */
@@ -225,14 +707,69 @@ cc3k_status_t cc3k_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_
 cc3k_status_t cc3k_data(cc3k_t *driver, uint8_t opcode, uint8_t *arg, uint8_t arg_length,
   uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length);
 
+/**
+ * @brief Fill in NETAPP command arguments
+ */
+void cc3k_netapp_dhcp_args(cc3k_command_netapp_dhcp_t *cmd, const cc3k_ipconfig_t *ipconfig);
+void cc3k_netapp_timers_args(cc3k_command_netapp_set_timers_t *cmd, const cc3k_netapp_timers_t *timers);
+
 cc3k_status_t cc3k_set_debug(cc3k_t *driver, uint32_t level);
 
+/**
+ * @brief Choose which unsolicited events the chip reports
+ *
+ * Events the driver needs are left unmasked, see cc3k_event_mask_filter.
+ *
+ * @param mask Bitwise OR of the CC3K_EVENT_* opcodes to suppress
+ */
+cc3k_status_t cc3k_set_event_mask(cc3k_t *driver, uint32_t mask);
+
+/**
+ * @brief Clear the events the driver cannot do without from a mask
+ *
+ * Drops CC3K_EVENT_MASK_REQUIRED, and CC3K_EVENT_PING_REPORT while the
+ * ping monitor is on.
+ */
+uint32_t cc3k_event_mask_filter(cc3k_t *driver, uint32_t mask);
+
 cc3k_status_t cc3k_process_event(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t arg_length);
 cc3k_status_t cc3k_recv_event(cc3k_socket_manager_t *socket_manager, int32_t sd, int32_t length);
 cc3k_status_t cc3k_tcp_close_wait_event(cc3k_socket_manager_t *socket_manager, cc3k_tcp_close_wait_event_t *ev);
 
 cc3k_status_t cc3k_loop(cc3k_t *driver, uint32_t time_ms);
 
+/**
+ * @brief Use a static address instead of DHCP
+ *
+ * The chip stores the setting and applies it from its next power up, so
+ * nothing is written if the chip already reports this address. Once the
+ * chip has reported the static address, sockets are opened as soon as
+ * the WLAN associates instead of waiting for the DHCP event.
+ *
+ * @param ipconfig Address to use, or NULL to return to DHCP
+ */
+cc3k_status_t cc3k_set_static_ip(cc3k_t *driver, const cc3k_ipconfig_t *ipconfig);
+
+/**
+ * @brief Check whether the address the chip reported is the static address
+ */
+int cc3k_static_ip_match(cc3k_t *driver);
+
+/**
+ * @brief Set the DHCP lease, ARP, keepalive and inactivity timers
+ */
+cc3k_status_t cc3k_set_timers(cc3k_t *driver, const cc3k_netapp_timers_t *timers);
+
+/**
+ * @brief Get the current address configuration
+ *
+ * The result can be saved and passed back as a static address on
+ * a later boot to skip DHCP.
+ *
+ * @return CC3K_INVALID_STATE if no address has been assigned yet
+ */
+cc3k_status_t cc3k_get_ipconfig(cc3k_t *driver, cc3k_ipconfig_t *ipconfig);
+
 /**
  * @brief Start connecting to an AP
  */
@@ -240,9 +777,71 @@ cc3k_status_t cc3k_wlan_connect(cc3k_t *driver, cc3k_security_type_t security_ty
 
 cc3k_status_t cc3k_socket(cc3k_t *driver, int family, int type, int protocol);
 cc3k_status_t cc3k_connect(cc3k_t *driver, int sd, cc3k_sockaddr_t *sa);
+cc3k_status_t cc3k_bind(cc3k_t *driver, int sd, cc3k_sockaddr_t *sa);
+cc3k_status_t cc3k_close(cc3k_t *driver, int sd);
+cc3k_status_t cc3k_select(cc3k_t *driver, uint8_t maxfd, uint32_t read_fd, uint32_t write_fd, uint32_t except_fd);
 cc3k_status_t cc3k_recv(cc3k_t *driver, int sd, uint16_t length);
+cc3k_status_t cc3k_recvfrom(cc3k_t *driver, int sd, uint16_t length);
+cc3k_status_t cc3k_send(cc3k_t *driver, int sd, uint8_t *payload, uint16_t payload_length);
 cc3k_status_t cc3k_sendto(cc3k_t *driver, int sd, uint8_t *payload, uint16_t payload_length, cc3k_sockaddr_t *sa);
 
+/**
+ * @brief Ask for the maximum segment size of a connected TCP socket
+ */
+cc3k_status_t cc3k_getmss(cc3k_t *driver, int sd);
+
+/**
+ * @brief Read from an NVMEM file
+ *
+ * The data arrives later as a CC3K_DATA_NVMEM_READ data frame.
+ */
+cc3k_status_t cc3k_nvmem_read(cc3k_t *driver, uint32_t file_id, uint32_t length, uint32_t offset);
+
+/**
+ * @brief Read the service pack version
+ */
+cc3k_status_t cc3k_read_sp_version(cc3k_t *driver);
+
+/**
+ * @brief Set a socket option on the chip
+ *
+ * Managed sockets should use cc3k_socket_setopt instead, which applies
+ * the option whenever the socket is opened.
+ */
+cc3k_status_t cc3k_setsockopt(cc3k_t *driver, int sd, uint32_t level, uint32_t optname, const uint8_t *optval, uint8_t optlen);
+
+/**
+ * @brief Read a socket option from the chip
+ *
+ * sockopt_pending is cleared when the response arrives, with the
+ * status in sockopt_status and the value in sockopt_value.
+ */
+cc3k_status_t cc3k_getsockopt(cc3k_t *driver, int sd, uint32_t level, uint32_t optname);
+
+/**
+ * @brief Start a host name lookup
+ *
+ * dns_pending is cleared when the response arrives, with the
+ * result in dns_result and the address in dns_ip.
+ */
+cc3k_status_t cc3k_gethostbyname(cc3k_t *driver, const char *hostname, uint8_t length);
+
+/**
+ * @brief Start a round of echo requests
+ *
+ * The chip reports the outcome with a CC3K_EVENT_PING_REPORT event once
+ * the round is over.
+ *
+ * @param ip Address in the byte order the chip reports addresses in
+ * @param timeout_ms Time to wait for each reply
+ */
+cc3k_status_t cc3k_ping_send(cc3k_t *driver, uint32_t ip, uint32_t attempts, uint32_t size, uint32_t timeout_ms);
+
+/**
+ * @brief Cancel the round of echo requests in progress
+ */
+cc3k_status_t cc3k_ping_stop(cc3k_t *driver);
+
 #ifdef __cplusplus
 } // End of extern "C"
 #endif
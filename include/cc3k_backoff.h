@@ -0,0 +1,72 @@
+/**
+ * @file cc3k_backoff.h
+ *
+ * Exponential retry backoff with jitter
+ */
+
+#ifndef _CC3K_BACKOFF_H
+#define _CC3K_BACKOFF_H
+
+#include <cc3k_type.h>
+
+/** @brief Default first retry delay when the config leaves it at zero */
+#ifndef CC3K_BACKOFF_INITIAL_MS
+#define CC3K_BACKOFF_INITIAL_MS 1000
+#endif
+
+/** @brief Default upper bound on a single retry delay */
+#ifndef CC3K_BACKOFF_MAX_MS
+#define CC3K_BACKOFF_MAX_MS 60000
+#endif
+
+/** @brief Default percentage of each delay that is randomized */
+#ifndef CC3K_BACKOFF_JITTER
+#define CC3K_BACKOFF_JITTER 50
+#endif
+
+/**
+ * @brief Backoff tuning
+ *
+ * A zeroed structure selects the defaults above.
+ */
+typedef struct _cc3k_backoff_config_t
+{
+  /** @brief Delay before the first retry */
+  uint32_t initial_ms;
+  /** @brief Cap on the delay between retries */
+  uint32_t max_ms;
+  /** @brief Percentage of the delay to randomize (0-100) */
+  uint8_t jitter;
+} cc3k_backoff_config_t;
+
+/**
+ * @brief Backoff state for one retrying operation
+ */
+typedef struct _cc3k_backoff_t
+{
+  /** @brief Milliseconds remaining before the next attempt is allowed */
+  uint32_t remaining;
+  /** @brief Number of consecutive failed attempts */
+  uint16_t attempts;
+} cc3k_backoff_t;
+
+/**
+ * @brief Forget previous failures, allowing an immediate attempt
+ */
+void cc3k_backoff_reset(cc3k_backoff_t *backoff);
+
+/**
+ * @brief Record a failed attempt and arm the next delay
+ *
+ * @return The delay in milliseconds before the next attempt
+ */
+uint32_t cc3k_backoff_next(cc3k_t *driver, cc3k_backoff_t *backoff, const cc3k_backoff_config_t *config);
+
+/**
+ * @brief Advance the backoff timer
+ *
+ * @return 1 if an attempt is allowed, 0 if still backing off
+ */
+int cc3k_backoff_elapsed(cc3k_backoff_t *backoff, uint32_t dt);
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * @file cc3k_boot.h
+ *
+ * Table driven bring-up sequence
+ */
+
+#ifndef _CC3K_BOOT_H
+#define _CC3K_BOOT_H
+
+#include <cc3k_type.h>
+
+/** @brief Maximum number of commands in the bring-up sequence */
+#ifndef CC3K_BOOT_STEPS_MAX
+#define CC3K_BOOT_STEPS_MAX 16
+#endif
+
+/**
+ * @brief One command of the bring-up sequence
+ *
+ * The argument is sent as-is and must stay valid until the
+ * driver reports that it is ready.
+ */
+typedef struct _cc3k_boot_step_t
+{
+  uint16_t opcode;
+  const uint8_t *arg;
+  uint8_t arg_length;
+} cc3k_boot_step_t;
+
+/**
+ * @brief Build the bring-up sequence
+ *
+ * The driver's own steps run first, followed by any steps in the
+ * boot_script table of the driver configuration.
+ */
+cc3k_status_t cc3k_boot_script_init(cc3k_t *driver);
+
+/**
+ * @brief Build the sequence for a chip that kept running through a host reset
+ *
+ * Settings made by the bring-up sequence are still in effect on the chip,
+ * so only its status is read, along with an identity that is not cached.
+ */
+cc3k_status_t cc3k_boot_script_warm(cc3k_t *driver);
+
+/**
+ * @brief Append a step to the bring-up sequence
+ */
+cc3k_status_t cc3k_boot_script_add(cc3k_t *driver, uint16_t opcode, const uint8_t *arg, uint8_t arg_length);
+
+/**
+ * @brief Issue the current step if no command is outstanding
+ */
+cc3k_status_t cc3k_boot_script_run(cc3k_t *driver);
+
+/**
+ * @brief Handle a command response during bring-up
+ *
+ * Advances to the next step when the response matches the current one,
+ * and issues it straight away.
+ */
+cc3k_status_t cc3k_boot_script_response(cc3k_t *driver, uint16_t opcode);
+
+#endif
@@ -123,6 +123,33 @@ typedef struct _cc3k_command_recv_t
   uint32_t flags;
 } __attribute__ ((packed)) cc3k_command_recv_t;
 
+typedef struct _cc3k_command_nvmem_read_t
+{
+  uint32_t file_id;
+  uint32_t length;
+  uint32_t offset;
+} __attribute__ ((packed)) cc3k_command_nvmem_read_t;
+
+/** @brief Largest option value the chip takes */
+#define CC3K_SOCKOPT_MAX 4
+
+typedef struct _cc3k_command_setsockopt_t
+{
+  uint32_t sd;
+  uint32_t level;
+  uint32_t optname;
+  uint32_t offset;  // Always 0x08
+  uint32_t optlen;
+  uint8_t optval[CC3K_SOCKOPT_MAX];
+} __attribute__ ((packed)) cc3k_command_setsockopt_t;
+
+typedef struct _cc3k_command_getsockopt_t
+{
+  uint32_t sd;
+  uint32_t level;
+  uint32_t optname;
+} __attribute__ ((packed)) cc3k_command_getsockopt_t;
+
 typedef struct _cc3k_command_select_t
 {
   uint32_t maxfd;
@@ -174,4 +201,51 @@ typedef struct _cc3k_command_ioctl_add_profile_t
   uint8_t key[CC3K_KEY_MAX];
 } __attribute__ ((packed)) cc3k_command_ioctl_add_profile_t;
 
+/**
+ * @brief NETAPP DHCP command arguments
+ *
+ * All zero addresses put the chip back into DHCP mode
+ */
+typedef struct _cc3k_command_netapp_dhcp_t
+{
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t default_gateway;
+  uint32_t zero;
+  uint32_t dns_server;
+} __attribute__ ((packed)) cc3k_command_netapp_dhcp_t;
+
+/**
+ * @brief NETAPP timer command arguments, all in seconds
+ */
+typedef struct _cc3k_command_netapp_set_timers_t
+{
+  uint32_t dhcp;
+  uint32_t arp;
+  uint32_t keepalive;
+  uint32_t inactivity;
+} __attribute__ ((packed)) cc3k_command_netapp_set_timers_t;
+
+/**
+ * @brief NETAPP ping command arguments
+ */
+typedef struct _cc3k_command_netapp_ping_send_t
+{
+  uint32_t ip;
+  uint32_t attempts;
+  uint32_t size;
+  /** @brief Milliseconds to wait for each reply */
+  uint32_t timeout;
+} __attribute__ ((packed)) cc3k_command_netapp_ping_send_t;
+
+/**
+ * @brief Host name lookup command arguments
+ */
+typedef struct _cc3k_command_gethostbyname_t
+{
+  uint32_t offset;  // Always 0x08
+  uint32_t length;
+  uint8_t hostname[CC3K_HOSTNAME_MAX];
+} __attribute__ ((packed)) cc3k_command_gethostbyname_t;
+
 #endif
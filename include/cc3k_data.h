@@ -7,8 +7,17 @@ typedef enum _cc3k_data_opcode_t
   CC3K_DATA_RECV = 0x82,
   CC3K_DATA_SENDTO = 0x83,
   CC3K_DATA_RECVFROM = 0x84,
+  CC3K_DATA_NVMEM_READ = 0x91,
 } cc3k_data_opcode_t;
 
+typedef struct _cc3k_data_send_t
+{
+  uint32_t sd;
+  uint32_t unk; // 0x0C
+  uint32_t payload_length;
+  uint32_t flags; // 0x0
+} cc3k_data_send_t;
+
 typedef struct _cc3k_data_sendto_t
 {
   uint32_t sd;
@@ -12,6 +12,47 @@ typedef enum _cc3k_event_opcode_t
   CC3K_EVENT_TCP_CLOSE_WAIT     = 0x8800
 } cc3k_event_opcode_t;
 
+/**
+ * @brief Unsolicited events that can be suppressed on the chip
+ *
+ * The mask passed to cc3k_set_event_mask is the bitwise OR of the event
+ * opcodes that the chip should stop reporting. CC3K_EVENT_FREE_BUFFER is
+ * flow control and cannot be masked, and neither can the events in
+ * CC3K_EVENT_MASK_REQUIRED. CC3K_EVENT_PING_REPORT stays unmasked while
+ * the ping monitor is on.
+ */
+#define CC3K_EVENT_MASK_ALL ( \
+  CC3K_EVENT_PING_REPORT | \
+  CC3K_EVENT_KEEPALIVE)
+
+/**
+ * @brief Events the driver relies on, cleared from any requested mask
+ *
+ * The link state, DHCP lease and peer closes drive the socket manager.
+ */
+#define CC3K_EVENT_MASK_REQUIRED ( \
+  CC3K_EVENT_WLAN_CONNECT | \
+  CC3K_EVENT_WLAN_DISCONNECT | \
+  CC3K_EVENT_WLAN_DHCP | \
+  CC3K_EVENT_TCP_CLOSE_WAIT)
+
+/**
+ * @brief Free buffer event payload
+ *
+ * Followed by num_handles cc3k_free_buffer_entry_t records.
+ */
+typedef struct _cc3k_free_buffer_event_t
+{
+  int8_t status;
+  uint16_t num_handles;
+} __attribute__ ((packed)) cc3k_free_buffer_event_t;
+
+typedef struct _cc3k_free_buffer_entry_t
+{
+  uint16_t handle;
+  uint16_t free;
+} __attribute__ ((packed)) cc3k_free_buffer_entry_t;
+
 /**
  * @brief Get status IOCTL event payload
  */
@@ -43,6 +84,12 @@ typedef struct _cc3k_recv_event_t
   uint32_t flags;
 } __attribute__ ((packed)) cc3k_recv_event_t;
 
+typedef struct _cc3k_getsockopt_event_t
+{
+  int8_t status;
+  uint32_t value;
+} __attribute__ ((packed)) cc3k_getsockopt_event_t;
+
 typedef struct _cc3k_select_event_t
 {
   int32_t status;
@@ -57,4 +104,24 @@ typedef struct _cc3k_tcp_close_wait_event_t
   uint32_t sd;
 } __attribute__ ((packed)) cc3k_tcp_close_wait_event_t;
 
+/**
+ * @brief Ping report event payload, round trip times in milliseconds
+ */
+typedef struct _cc3k_ping_report_event_t
+{
+  int8_t status;
+  uint32_t sent;
+  uint32_t received;
+  uint32_t rtt_min;
+  uint32_t rtt_max;
+  uint32_t rtt_avg;
+} __attribute__ ((packed)) cc3k_ping_report_event_t;
+
+typedef struct _cc3k_gethostbyname_event_t
+{
+  int8_t status;
+  int32_t result;
+  uint32_t ip;
+} __attribute__ ((packed)) cc3k_gethostbyname_event_t;
+
 #endif
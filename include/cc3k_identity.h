@@ -0,0 +1,69 @@
+/**
+ * @file cc3k_identity.h
+ *
+ * Chip identity, cached on the host between boots
+ */
+
+#ifndef _CC3K_IDENTITY_H
+#define _CC3K_IDENTITY_H
+
+#include <cc3k_type.h>
+
+/** @brief Marks a filled in identity cache */
+#define CC3K_IDENTITY_MAGIC 0x4b334343
+
+/** @brief NVMEM file holding the MAC address */
+#define CC3K_NVMEM_MAC_FILEID 6
+#define CC3K_MAC_LENGTH 6
+
+/** @brief Parts of the identity still being read from the chip */
+#define CC3K_IDENTITY_MAC     0x01
+#define CC3K_IDENTITY_VERSION 0x02
+
+/**
+ * @brief Chip identity
+ *
+ * Kept by the application in persistent storage and handed back through
+ * the driver configuration, so later boots need not read it again.
+ */
+typedef struct _cc3k_identity_t
+{
+  uint32_t magic;
+  /** @brief Service pack version, package ID then build number */
+  uint8_t sp_version[2];
+  uint8_t mac[CC3K_MAC_LENGTH];
+  /** @brief Covers every field above */
+  uint32_t checksum;
+} cc3k_identity_t;
+
+/**
+ * @brief Use the cached identity, or add the steps that read it to the bring-up sequence
+ */
+cc3k_status_t cc3k_identity_boot(cc3k_t *driver);
+
+/**
+ * @brief Check the magic and checksum of a cached identity
+ *
+ * @return 1 if the identity can be used
+ */
+int cc3k_identity_valid(const cc3k_identity_t *identity);
+
+/**
+ * @brief Handle the response to a service pack version read
+ */
+cc3k_status_t cc3k_identity_version_event(cc3k_t *driver, const uint8_t *arg, uint8_t arg_length);
+
+/**
+ * @brief Handle NVMEM data read for the identity
+ */
+cc3k_status_t cc3k_identity_nvmem_event(cc3k_t *driver, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Get the chip identity
+ *
+ * @return CC3K_OK, CC3K_BUSY while it is still being read, or
+ *         CC3K_INVALID if no identity cache is configured
+ */
+cc3k_status_t cc3k_get_identity(cc3k_t *driver, cc3k_identity_t *identity);
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * @file cc3k_ping.h
+ *
+ * Link health monitor built on the chip's ping service
+ */
+
+#ifndef _CC3K_PING_H
+#define _CC3K_PING_H
+
+#include <cc3k_type.h>
+
+/** @brief Default echo requests per round */
+#ifndef CC3K_PING_ATTEMPTS
+#define CC3K_PING_ATTEMPTS 3
+#endif
+
+/** @brief Default echo request payload size */
+#ifndef CC3K_PING_SIZE
+#define CC3K_PING_SIZE 32
+#endif
+
+/** @brief Default time the chip waits for each echo reply */
+#ifndef CC3K_PING_TIMEOUT_MS
+#define CC3K_PING_TIMEOUT_MS 1000
+#endif
+
+/** @brief Default number of bad rounds in a row before the link counts as degraded */
+#ifndef CC3K_PING_DEGRADED_ROUNDS
+#define CC3K_PING_DEGRADED_ROUNDS 2
+#endif
+
+/**
+ * @brief Result of one ping round
+ */
+typedef struct _cc3k_ping_report_t
+{
+  uint32_t sent;
+  uint32_t received;
+  /** @brief Round trip times in milliseconds, zero if nothing came back */
+  uint32_t rtt_min;
+  uint32_t rtt_max;
+  uint32_t rtt_avg;
+} cc3k_ping_report_t;
+
+/**
+ * @brief Ping round callback
+ *
+ * Called after each round with its report and whether the link is
+ * currently considered degraded. May be called in interrupt context.
+ */
+typedef void (cc3k_ping_callback_t)(cc3k_t *driver, const cc3k_ping_report_t *report, uint8_t degraded);
+
+/**
+ * @brief Link monitor tuning
+ *
+ * Zeroed fields select the defaults above. The monitor is off while
+ * interval_ms is zero.
+ */
+typedef struct _cc3k_ping_config_t
+{
+  /** @brief Time between the start of ping rounds */
+  uint32_t interval_ms;
+  /** @brief Echo requests per round */
+  uint32_t attempts;
+  /** @brief Echo request payload size */
+  uint32_t size;
+  /** @brief Time the chip waits for each echo reply */
+  uint32_t timeout_ms;
+
+  /** @brief Average round trip above which a round is bad, zero to ignore */
+  uint32_t rtt_threshold_ms;
+  /** @brief Percentage of lost replies above which a round is bad */
+  uint8_t loss_threshold;
+  /** @brief Bad rounds in a row before the link counts as degraded */
+  uint8_t degraded_rounds;
+
+  cc3k_ping_callback_t *callback;
+} cc3k_ping_config_t;
+
+/**
+ * @brief Link monitor state and statistics
+ */
+typedef struct _cc3k_ping_t
+{
+  /** @brief Milliseconds since the last round started */
+  uint32_t elapsed;
+  /** @brief Set while a round is waiting for its report */
+  uint8_t pending;
+
+  /** @brief Last completed round */
+  cc3k_ping_report_t last;
+
+  /** @brief Totals over every round */
+  uint32_t rounds;
+  uint32_t sent;
+  uint32_t received;
+  /** @brief Rounds that never produced a report */
+  uint32_t lost_reports;
+
+  /** @brief Smoothed average round trip in milliseconds */
+  uint32_t rtt_smoothed;
+  /** @brief Lowest and highest round trip seen */
+  uint32_t rtt_min;
+  uint32_t rtt_max;
+
+  /** @brief Bad rounds in a row */
+  uint8_t bad_rounds;
+  /** @brief Set while the link is considered degraded */
+  uint8_t degraded;
+} cc3k_ping_t;
+
+/**
+ * @brief Start ping rounds when they are due, called from cc3k_loop
+ */
+void cc3k_ping_update(cc3k_t *driver, uint32_t dt);
+
+/**
+ * @brief Handle a ping report event from the chip
+ */
+cc3k_status_t cc3k_ping_report_event(cc3k_t *driver, const uint8_t *arg, uint8_t arg_length);
+
+/**
+ * @brief Forget the round in flight, used when the link goes down
+ */
+void cc3k_ping_reset(cc3k_t *driver);
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file cc3k_pool.h
+ *
+ * Fixed size packet buffer pool
+ */
+
+#ifndef _CC3K_POOL_H
+#define _CC3K_POOL_H
+
+#include <cc3k_type.h>
+
+/** @brief Largest number of blocks a single pool can manage */
+#define CC3K_POOL_BLOCKS_MAX 32
+
+/**
+ * @brief Pool of equally sized buffers carved out of one storage area
+ *
+ * Free blocks are tracked in a bitmap that is updated with atomic
+ * compare and swap, so blocks can be taken and returned from interrupt
+ * context as well as the main loop.
+ */
+typedef struct _cc3k_pool_t
+{
+  /** @brief Backing storage, block_size * count bytes */
+  uint8_t *storage;
+  uint16_t block_size;
+  uint8_t count;
+
+  /** @brief One bit per block, set while the block is free */
+  volatile uint32_t free;
+
+  /** @brief Blocks currently handed out */
+  volatile uint8_t in_use;
+  /** @brief Most blocks ever handed out at the same time */
+  volatile uint8_t high_water;
+  /** @brief Number of successful allocations */
+  volatile uint32_t allocs;
+  /** @brief Number of allocations refused because the pool was empty */
+  volatile uint32_t failures;
+} cc3k_pool_t;
+
+/**
+ * @brief Set up a pool over caller supplied storage
+ *
+ * @param storage Memory for the blocks, at least block_size * count bytes
+ * @param count Number of blocks, at most CC3K_POOL_BLOCKS_MAX
+ */
+cc3k_status_t cc3k_pool_init(cc3k_pool_t *pool, uint8_t *storage, uint16_t block_size, uint8_t count);
+
+/**
+ * @brief Take a block from the pool
+ *
+ * @return Pointer to the start of the block, or NULL if the pool is empty
+ */
+uint8_t *cc3k_pool_alloc(cc3k_pool_t *pool);
+
+/**
+ * @brief Return a block to the pool
+ *
+ * Any pointer into the block may be passed.
+ */
+cc3k_status_t cc3k_pool_free(cc3k_pool_t *pool, uint8_t *block);
+
+/**
+ * @brief Index of the block containing a pointer
+ *
+ * @return The index, or -1 if the pointer is outside the pool
+ */
+int cc3k_pool_index(cc3k_pool_t *pool, const uint8_t *p);
+
+/**
+ * @brief Number of blocks available
+ */
+uint8_t cc3k_pool_available(cc3k_pool_t *pool);
+
+#endif
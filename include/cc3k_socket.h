@@ -2,14 +2,34 @@
 #define CC3K_SOCKET_H_
 
 #include <cc3k_type.h>
+#include <cc3k_backoff.h>
 
 #define CC3K_MAX_SOCKETS 8
 
+/** @brief Bytes requested by each receive on a socket */
+#define CC3K_RECV_LENGTH 1500
+
 #define AF_INET              2
 
 // IPv6 is not supported
 //#define AF_INET6             23
 
+/** @brief Socket option level, the only one the chip has */
+#define SOL_SOCKET              0xffff
+
+/** @brief Receive without blocking, SOCK_ON or SOCK_OFF */
+#define SOCKOPT_RECV_NONBLOCK   0
+/** @brief Milliseconds a blocking receive waits for data, the chip minimum is 20 */
+#define SOCKOPT_RECV_TIMEOUT    1
+/** @brief Accept without blocking, SOCK_ON or SOCK_OFF */
+#define SOCKOPT_ACCEPT_NONBLOCK 2
+
+/** @brief Number of socket options */
+#define CC3K_SOCKOPT_COUNT 3
+
+#define SOCK_ON                 0
+#define SOCK_OFF                1
+
 typedef enum _cc3k_protocol_type_t
 {
   IPPROTO_TCP = 6,
@@ -26,6 +46,137 @@ typedef struct _cc3k_socket_t cc3k_socket_t;
 
 typedef void (cc3k_data_callback_t)(cc3k_t *driver, cc3k_socket_t *socket, uint8_t *data, uint16_t length, cc3k_sockaddr_t *from);
 
+/**
+ * @brief Receive window callback
+ *
+ * Returns the number of bytes the application can accept, or zero to
+ * leave pending data on the chip for now.
+ */
+typedef uint16_t (cc3k_window_callback_t)(cc3k_t *driver, cc3k_socket_t *socket);
+
+/**
+ * @brief Socket readiness events
+ */
+typedef enum _cc3k_socket_ready_t
+{
+  CC3K_SOCKET_CONNECTED = 0x01, // Socket is open and ready for data
+  CC3K_SOCKET_READABLE  = 0x02, // Data is waiting on the chip
+  CC3K_SOCKET_WRITABLE  = 0x04, // Chip can accept data for the socket
+  CC3K_SOCKET_CLOSED    = 0x08  // Connection was closed or could not be made
+} cc3k_socket_ready_t;
+
+/**
+ * @brief Readiness callback
+ *
+ * Called with a bitmask of cc3k_socket_ready_t events as soon as the
+ * driver learns of them. This may run in interrupt context.
+ */
+typedef void (cc3k_ready_callback_t)(cc3k_t *driver, cc3k_socket_t *socket, uint8_t events);
+
+/**
+ * @brief Stream pull callback
+ *
+ * Points data at up to length bytes of the stream and returns how many
+ * there are, or zero at the end of the stream. The bytes must stay
+ * valid until the next call. May be called in interrupt context.
+ */
+typedef uint16_t (cc3k_stream_pull_t)(cc3k_t *driver, cc3k_socket_t *socket, const uint8_t **data, uint16_t length);
+
+/**
+ * @brief Stream completion callback
+ *
+ * Called with CC3K_OK once every byte has been handed to the chip, or
+ * CC3K_ERROR if the socket closed first. May be called in interrupt context.
+ */
+typedef void (cc3k_stream_done_t)(cc3k_t *driver, cc3k_socket_t *socket, cc3k_status_t status, uint32_t sent);
+
+/**
+ * @brief Outgoing stream on a socket
+ *
+ * The source is either a buffer of any length, or a pull callback.
+ */
+typedef struct _cc3k_stream_t
+{
+  const uint8_t *data;
+  uint32_t length;
+  cc3k_stream_pull_t *pull;
+  cc3k_stream_done_t *done;
+
+  /** @brief Bytes handed to the chip so far */
+  uint32_t sent;
+
+  /** @brief Segment waiting for the link */
+  const uint8_t *pending;
+  uint16_t pending_length;
+
+  uint8_t active;
+  /** @brief Set while a segment is being sent, keeps the interrupt path out */
+  volatile uint8_t busy;
+} cc3k_stream_t;
+
+/**
+ * @brief One datagram of a batch
+ */
+typedef struct _cc3k_datagram_t
+{
+  uint8_t *data;
+
+  /**
+   * @brief Bytes to send
+   *
+   * On receive this is the room in data, and is replaced by the number
+   * of bytes received.
+   */
+  uint16_t length;
+
+  /** @brief Destination, NULL for the socket address. Unused on receive. */
+  cc3k_sockaddr_t *addr;
+} cc3k_datagram_t;
+
+/**
+ * @brief Batch completion callback
+ *
+ * Called with the number of datagrams sent or received. May be called
+ * in interrupt context.
+ */
+typedef void (cc3k_batch_done_t)(cc3k_t *driver, cc3k_socket_t *socket, cc3k_status_t status, uint16_t count);
+
+/**
+ * @brief Datagrams queued on a socket
+ */
+typedef struct _cc3k_batch_t
+{
+  cc3k_datagram_t *vec;
+  uint16_t count;
+  cc3k_batch_done_t *done;
+
+  /** @brief Next datagram to send or fill */
+  uint16_t index;
+
+  uint8_t active;
+  /** @brief Set while datagrams are being sent, keeps the interrupt path out */
+  volatile uint8_t busy;
+} cc3k_batch_t;
+
+/**
+ * @brief Buffer that merges small writes into one data frame
+ */
+typedef struct _cc3k_coalesce_t
+{
+  uint8_t *buffer;
+  uint16_t size;
+
+  /** @brief Send once this many bytes are waiting, zero for a full buffer */
+  uint16_t threshold;
+  /** @brief Longest a byte may wait before it is sent */
+  uint32_t delay_ms;
+
+  /** @brief Bytes waiting */
+  uint16_t length;
+  /** @brief Milliseconds since the oldest waiting byte was written */
+  uint32_t elapsed;
+} cc3k_coalesce_t;
+
 typedef enum _cc3k_socket_state_t
 {
   SOCKET_STATE_INIT,        // Socket is in the initial state
@@ -39,7 +190,8 @@ typedef enum _cc3k_socket_state_t
   SOCKET_STATE_READY,       // Socket is established
   SOCKET_STATE_CLOSING,     // Socket is waiting for close response
   SOCKET_STATE_CLOSE_WAIT,  // Socket received close wait event, closing this side 
-  SOCKET_STATE_FAILED       // Failed to initialize the socket
+  SOCKET_STATE_FAILED,      // Failed to initialize the socket
+  SOCKET_STATE_CLOSED       // Closed for good, the socket manager leaves it alone
 } cc3k_socket_state_t;
 
 struct _cc3k_socket_t
@@ -47,8 +199,8 @@ struct _cc3k_socket_t
   /** @brief State of the socket */
   cc3k_socket_state_t state;
 
-  /** @brief Milliseconds reamining before retrying */
-  uint32_t retry_timeout;
+  /** @brief Delay before retrying a failed connection */
+  cc3k_backoff_t backoff;
 
   /** @brief Socket descriptor returned by the chip */
   uint32_t sd;
@@ -60,18 +212,92 @@ struct _cc3k_socket_t
   // For now, store the sockaddr in here
   cc3k_sockaddr_t sockaddr;
 
-  int rx;
-  int rx_bytes;
+  /** @brief Traffic counters, read with cc3k_socket_stats_snapshot */
+  cc3k_socket_stats_t stats;
 
   uint8_t readable;
 
+  /**
+   * @brief Share of the command slot relative to other sockets
+   *
+   * The socket may issue this many commands in a row before the socket
+   * manager moves on. Zero counts as one.
+   */
+  uint8_t weight;
+  /** @brief Commands left in the current turn */
+  uint8_t credits;
+
+  /** @brief Maximum segment size reported by the chip, zero until known */
+  uint16_t mss;
+  uint8_t mss_requested;
+
+  /** @brief Outgoing stream, see cc3k_socket_stream */
+  cc3k_stream_t stream;
+
+  /** @brief Outgoing datagrams, see cc3k_socket_sendmmsg */
+  cc3k_batch_t tx_batch;
+  /** @brief Buffers for incoming datagrams, see cc3k_socket_recvmmsg */
+  cc3k_batch_t rx_batch;
+
+  /** @brief Small writes waiting to be sent, see cc3k_socket_coalesce */
+  cc3k_coalesce_t coalesce;
+
+  /**
+   * @brief Socket option values, indexed by option name
+   *
+   * Set with cc3k_socket_setopt and sent to the chip by the socket manager.
+   */
+  uint32_t options[CC3K_SOCKOPT_COUNT];
+  /** @brief Options that have been set */
+  uint8_t options_set;
+  /** @brief Options still to be sent to the chip */
+  uint8_t options_pending;
+  /** @brief Option being sent to the chip */
+  uint8_t option_applying;
+  /** @brief Chip result of the last option sent, negative on failure */
+  int32_t option_result;
+
+  /** @brief Length asked for by the last receive */
+  uint16_t recv_length;
+  /** @brief Bytes read back to back since the last short read */
+  uint32_t drain_bytes;
+
   // Flag to indicate if this socket is a server
   // TODO: Clean this up
   int bind;
 
+  /**
+   * @brief Do not reopen the socket once it has closed or failed
+   *
+   * The socket ends up in SOCKET_STATE_CLOSED instead.
+   */
+  uint8_t oneshot;
+
   /** @brief Socket data reception callback */
   cc3k_data_callback_t *receive_callback;
 
+  /** @brief Optional limit on how much data to receive at once */
+  cc3k_window_callback_t *receive_window;
+
+  /** @brief Set while the socket is held by the socket manager */
+  uint8_t registered;
+  /** @brief Index of the socket manager slot holding this socket */
+  uint8_t slot;
+  /** @brief Close and release the slot once the chip has let go of it */
+  uint8_t remove;
+
+  /** @brief Socket readiness callback */
+  cc3k_ready_callback_t *ready_callback;
+
+  /**
+   * @brief Readiness events to report
+   *
+   * CC3K_SOCKET_WRITABLE also adds the socket to the select write set.
+   * It is cleared when reported, and must be set again to hear of the
+   * next time the socket is writable.
+   */
+  uint8_t ready_mask;
+
 };
 
 /**
@@ -87,16 +313,35 @@ typedef struct _cc3k_socket_manager_t
   /** @brief Array of pointers to all active sockets */
   cc3k_socket_t *socket[CC3K_MAX_SOCKETS]; 
 
+  /** @brief Slot served first on the next pass */
+  uint8_t next;
+
+  /** @brief Stack of unused slot indices */
+  uint8_t free_slots[CC3K_MAX_SOCKETS];
+  uint8_t num_free;
+
   /** @brief Current socket with a pending command */
   cc3k_socket_t *current;
 
   /** @brief Number of used sockets */
   int num_sockets;
 
+  /** @brief Extra time the chip may take over the receive in flight */
+  uint32_t recv_timeout_ms;
+
+  /** @brief Socket whose stream or batch sent the last data frame */
+  cc3k_socket_t *streaming;
+
+  /** @brief Descriptors left open on the chip by the host before a warm start */
+  uint32_t stale;
+
   /** @brief Flag to indicate if a select call is pending */
   // TODO: Move boolean flags to a bitmask
   uint8_t select_pending;
 
+  /** @brief Set after a receive timeout read, the next turn goes to select */
+  uint8_t select_due;
+
 } cc3k_socket_manager_t;
 
 cc3k_status_t cc3k_socket_manager_init(cc3k_t *driver, cc3k_socket_manager_t *socket_manager);
@@ -105,8 +350,175 @@ cc3k_status_t cc3k_socket_manager_loop(cc3k_socket_manager_t *socket_manager, ui
 cc3k_status_t cc3k_socket_init(cc3k_socket_t *socket, cc3k_socket_type_t type);
 cc3k_status_t cc3k_socket_bind(cc3k_socket_t *socket, cc3k_sockaddr_t *sa);
 
+/**
+ * @brief Hand a socket to the socket manager
+ *
+ * The manager opens it on the chip once the network is up. The socket
+ * memory must stay valid until the socket has been removed.
+ */
 cc3k_status_t cc3k_socket_add(cc3k_t *driver, cc3k_socket_t *socket);
 
+/**
+ * @brief Take a socket away from the socket manager
+ *
+ * A socket open on the chip is closed first, and its slot is only
+ * recycled once the close has completed. The socket memory can be
+ * reused when registered is cleared.
+ *
+ * Must not be called from a socket callback, which may run in
+ * interrupt context.
+ *
+ * @return CC3K_OK if the socket was released straight away,
+ *         CC3K_BUSY if it is still closing
+ */
+cc3k_status_t cc3k_socket_remove(cc3k_t *driver, cc3k_socket_t *socket);
+
+/**
+ * @brief Send a buffer of any length on a connected TCP socket
+ *
+ * The data is cut into segments that fit the MSS and the chip buffers,
+ * and each segment goes out as soon as the link and a chip buffer are
+ * free. The buffer must stay valid until the done callback. The stream
+ * ends with CC3K_ERROR if the connection is lost.
+ *
+ * @return CC3K_BUSY if the socket is already streaming,
+ *         CC3K_INVALID_STATE if it is not connected
+ */
+cc3k_status_t cc3k_socket_stream(cc3k_t *driver, cc3k_socket_t *socket, const uint8_t *data, uint32_t length, cc3k_stream_done_t *done);
+
+/**
+ * @brief Send a stream produced by a pull callback on a connected TCP socket
+ */
+cc3k_status_t cc3k_socket_stream_pull(cc3k_t *driver, cc3k_socket_t *socket, cc3k_stream_pull_t *pull, cc3k_stream_done_t *done);
+
+/**
+ * @brief Queue several datagrams on a UDP socket
+ *
+ * The datagrams are sent back to back, each as soon as the link and a
+ * chip buffer are free, without waiting for the loop in between. The
+ * vector and its data must stay valid until the done callback. The
+ * batch ends with CC3K_ERROR if the socket is closed or reset.
+ *
+ * @return CC3K_BUSY if a batch is already queued on the socket,
+ *         CC3K_INVALID_STATE if the socket is not ready
+ */
+cc3k_status_t cc3k_socket_sendmmsg(cc3k_t *driver, cc3k_socket_t *socket, cc3k_datagram_t *vec, uint16_t count, cc3k_batch_done_t *done);
+
+/**
+ * @brief Collect incoming datagrams on a UDP socket into a vector
+ *
+ * While the batch is queued, datagrams are copied into the vector
+ * instead of going to the receive callback. The done callback runs once
+ * the vector is full, or once select finds the socket empty after at
+ * least one datagram, or with CC3K_ERROR if the socket is closed or reset.
+ *
+ * @return CC3K_BUSY if a batch is already queued on the socket,
+ *         CC3K_INVALID_STATE if the socket is not ready
+ */
+cc3k_status_t cc3k_socket_recvmmsg(cc3k_t *driver, cc3k_socket_t *socket, cc3k_datagram_t *vec, uint16_t count, cc3k_batch_done_t *done);
+
+/**
+ * @brief Merge small writes on a socket
+ *
+ * Writes are collected in the buffer and sent as one frame once
+ * threshold bytes are waiting, or delay_ms after the oldest of them was
+ * written. On a UDP socket the merged writes arrive as one datagram.
+ * A NULL buffer turns coalescing off.
+ *
+ * @param size Capacity of the buffer, at most CC3K_SEND_MAX is used
+ */
+cc3k_status_t cc3k_socket_coalesce(cc3k_socket_t *socket, uint8_t *buffer, uint16_t size, uint16_t threshold, uint32_t delay_ms);
+
+/**
+ * @brief Write data on a ready socket
+ *
+ * Without a coalescing buffer the data is sent straight away. With one,
+ * it is copied in and sent later unless the buffer has filled.
+ *
+ * @return CC3K_BUSY if the data could not be taken yet
+ */
+cc3k_status_t cc3k_socket_write(cc3k_t *driver, cc3k_socket_t *socket, uint8_t *data, uint16_t length);
+
+/**
+ * @brief Set a socket option
+ *
+ * The option is sent to the chip before the socket connects or binds,
+ * or on the next loop pass if the socket is already open. It applies
+ * again whenever the socket is reopened.
+ *
+ * How the socket manager reads a socket depends on the options:
+ * - SOCKOPT_RECV_NONBLOCK on: after each read the next one is issued
+ *   straight away, until the chip answers that the socket is empty.
+ * - A blocking socket with SOCKOPT_RECV_TIMEOUT: receives are issued
+ *   without waiting for select, and the chip holds each one until data
+ *   arrives or the timeout expires. No other command can be sent
+ *   meanwhile, so keep the timeout short.
+ *
+ * @return CC3K_INVALID for an unknown level or option
+ */
+cc3k_status_t cc3k_socket_setopt(cc3k_socket_t *socket, uint32_t level, uint32_t optname, uint32_t value);
+
+/**
+ * @brief Read back a socket option
+ *
+ * Options that were never set read as the chip defaults.
+ */
+cc3k_status_t cc3k_socket_getopt(cc3k_socket_t *socket, uint32_t level, uint32_t optname, uint32_t *value);
+
+/**
+ * @brief Handle the response to a set socket option command
+ */
+cc3k_status_t cc3k_sockopt_event(cc3k_socket_manager_t *socket_manager, int32_t result);
+
+/**
+ * @brief Handle the response to a receive command
+ *
+ * A zero length means the socket had nothing to read.
+ */
+cc3k_status_t cc3k_recv_event(cc3k_socket_manager_t *socket_manager, int32_t sd, int32_t length);
+
+/**
+ * @brief Data frame transmit complete, called from cc3k_spi_done
+ *
+ * Sends the next segment or datagram of the socket that sent the last frame.
+ */
+cc3k_status_t cc3k_socket_tx_done(cc3k_socket_manager_t *socket_manager);
+
+cc3k_status_t cc3k_mss_event(cc3k_socket_manager_t *socket_manager, int32_t result);
+
+/**
+ * @brief Give up on the socket command in flight
+ *
+ * Used when the driver abandons a command the chip never answered.
+ */
+cc3k_status_t cc3k_socket_abort(cc3k_socket_manager_t *socket_manager);
+
+/**
+ * @brief Forget every descriptor after the chip has been reset
+ *
+ * Sockets are reopened from scratch, one-shot sockets are closed.
+ */
+cc3k_status_t cc3k_socket_manager_reset(cc3k_socket_manager_t *socket_manager);
+
+/**
+ * @brief Release removed sockets while the network is down
+ *
+ * The chip dropped their descriptors along with the link, so there is
+ * nothing left to close. Called from the main loop in place of
+ * cc3k_socket_manager_loop.
+ */
+cc3k_status_t cc3k_socket_manager_offline(cc3k_socket_manager_t *socket_manager);
+
+/**
+ * @brief Record data sent on a descriptor against its socket
+ */
+cc3k_status_t cc3k_socket_tx_event(cc3k_socket_manager_t *socket_manager, int32_t sd, uint32_t data_length);
+
+/**
+ * @brief Take a consistent copy of one socket's counters
+ */
+cc3k_status_t cc3k_socket_stats_snapshot(cc3k_t *driver, cc3k_socket_t *socket, cc3k_socket_stats_t *stats);
+
 /**
  * @brief Handle a parsed data event from the CC3000
  */
@@ -0,0 +1,81 @@
+/**
+ * @file cc3k_stats.h
+ *
+ * Traffic counters and throughput rates
+ */
+
+#ifndef _CC3K_STATS_H
+#define _CC3K_STATS_H
+
+#include <cc3k_type.h>
+
+/** @brief Length of one throughput sample */
+#ifndef CC3K_RATE_SAMPLE_MS
+#define CC3K_RATE_SAMPLE_MS 250
+#endif
+
+/** @brief Number of samples averaged into the reported rates */
+#ifndef CC3K_RATE_SAMPLES
+#define CC3K_RATE_SAMPLES 4
+#endif
+
+#define CC3K_RATE_WINDOW_MS (CC3K_RATE_SAMPLE_MS * CC3K_RATE_SAMPLES)
+
+/** @brief Attempts made by a snapshot before giving up */
+#ifndef CC3K_STATS_SNAPSHOT_RETRIES
+#define CC3K_STATS_SNAPSHOT_RETRIES 8
+#endif
+
+/**
+ * @brief Per socket traffic counters
+ */
+typedef struct _cc3k_socket_stats_t
+{
+  uint64_t tx;
+  uint64_t tx_bytes;
+  uint64_t rx;
+  uint64_t rx_bytes;
+  /** @brief Received data the socket had no room or callback for */
+  uint32_t drops;
+  /** @brief Connect attempts made after a failure */
+  uint32_t retries;
+} cc3k_socket_stats_t;
+
+/**
+ * @brief Moving window of per sample traffic
+ */
+typedef struct _cc3k_rate_window_t
+{
+  uint32_t tx_bytes[CC3K_RATE_SAMPLES];
+  uint32_t rx_bytes[CC3K_RATE_SAMPLES];
+  uint16_t tx[CC3K_RATE_SAMPLES];
+  uint16_t rx[CC3K_RATE_SAMPLES];
+  uint8_t index;
+
+  /** @brief Milliseconds into the current sample */
+  uint32_t elapsed;
+
+  /** @brief Totals at the start of the current sample */
+  uint64_t last_tx_bytes;
+  uint64_t last_rx_bytes;
+  uint64_t last_tx;
+  uint64_t last_rx;
+} cc3k_rate_window_t;
+
+/**
+ * @brief Advance the throughput window, called from cc3k_loop
+ */
+void cc3k_stats_update(cc3k_t *driver, uint32_t dt);
+
+/**
+ * @brief Take a consistent copy of the driver counters
+ *
+ * Safe to call from the main loop context while the interrupt handlers
+ * are updating counters. The copy is retried if an interrupt ran
+ * during it.
+ *
+ * @return CC3K_OK, or CC3K_BUSY if interrupts kept interfering
+ */
+cc3k_status_t cc3k_stats_snapshot(cc3k_t *driver, cc3k_stats_t *stats);
+
+#endif
@@ -10,6 +10,7 @@
 #include <inttypes.h>
 
 typedef struct _cc3k_t cc3k_t;
+typedef struct _cc3k_stats_t cc3k_stats_t;
 
 typedef enum _cc3k_status_t
 {
@@ -18,6 +19,7 @@ typedef enum _cc3k_status_t
   CC3K_INVALID,
   CC3K_INVALID_STATE,
   CC3K_BUSY,
+  CC3K_TIMEOUT,
 } cc3k_status_t;
 
 /**
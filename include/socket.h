@@ -33,6 +33,13 @@ typedef struct _sockaddr_t
   uint8_t sa_data[14];
 } sockaddr;
 
+/**
+ * @brief Attach the socket layer to a driver
+ *
+ * The blocking calls wait through the wait hook in the driver configuration.
+ */
+int cc3k_bsd_init(cc3k_t *driver);
+
 int socket(int domain, int family, int protocol);
 int bind(int socket, const sockaddr *address, socklen_t address_len);
 int connect(int socket, const sockaddr *address, socklen_t address_len);
@@ -44,6 +51,10 @@ int sendto(int socket, const void *buf, int len, int flags,
                   const sockaddr *to, socklen_t tolen);
 
 int recv(int socket, void *buf, int len, int flags);
+
+int setsockopt(int socket, long level, long optname, const void *optval, socklen_t optlen);
+int getsockopt(int socket, long level, long optname, void *optval, socklen_t *optlen);
+
 int gethostbyname(char* hostname, int length, uint32_t* ip);
 
 #ifdef __cplusplus
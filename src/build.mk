@@ -7,6 +7,13 @@ CSRC += src/cc3k.c
 CSRC += src/cc3k_packet.c
 CSRC += src/cc3k_event.c
 CSRC += src/cc3k_socket.c
+CSRC += src/cc3k_backoff.c
+CSRC += src/cc3k_boot.c
+CSRC += src/cc3k_pool.c
+CSRC += src/cc3k_stats.c
+CSRC += src/cc3k_ping.c
+CSRC += src/cc3k_identity.c
+CSRC += src/socket.c
 
 # ASM source files included in this build.
 ASRC +=
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <cc3k.h>
 #include <cc3k_command.h>
 #include <cc3k_data.h>
@@ -10,26 +11,9 @@
 #include <stdio.h>
 #endif
 
-// Set the internal chip debug mask
-// This controls which messages the chip will output
-// on the 1.8v UART pins. These are not accessible on the Spark
-#define CC3K_DEBUG_MASK 0x00000000
-
 static cc3k_status_t _process_event(cc3k_t *driver);
 static cc3k_status_t cc3k_read_header(cc3k_t *driver);
 
-/**
- * @brief Poll the interrupt pin and wait for it to fall
- */
-static void _interrupt_poll_wait(cc3k_t *driver)
-{
-  while(1)
-  {
-    if((*driver->config->readInterrupt)() == 0)
-      break;
-  }
-}
-
 
 static inline void _assert_cs(cc3k_t *driver, int assert)
 {
@@ -75,7 +59,99 @@ static void _send_command(cc3k_t *driver)
   _spi(driver, driver->packet_tx_buffer, driver->packet_rx_buffer, driver->packet_tx_buffer_length);
 }
 
-cc3k_status_t cc3k_send_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t args_length)
+cc3k_priority_t cc3k_command_priority(uint16_t opcode)
+{
+  switch(opcode)
+  {
+    case CC3K_COMMAND_SELECT:
+    case CC3K_COMMAND_IOCTL_STATUSGET:
+    case CC3K_COMMAND_IOCTL_GET_SCANRESULTS:
+    case CC3K_COMMAND_NETAPP_PING_SEND:
+    case CC3K_COMMAND_NETAPP_PING_REPORT:
+    case CC3K_COMMAND_NETAPP_GETIPCONFIG:
+      return CC3K_PRIORITY_BACKGROUND;
+    case CC3K_COMMAND_RECV:
+    case CC3K_COMMAND_RECVFROM:
+    case CC3K_COMMAND_GETHOSTBYNAME:
+      return CC3K_PRIORITY_DATA;
+    default:
+      return CC3K_PRIORITY_CONTROL;
+  }
+}
+
+/**
+ * @brief Check whether a traffic class may use the link
+ *
+ * A refused class claims the link for a short while, which holds back
+ * every lower class until it gets its turn.
+ */
+static int _priority_gate(cc3k_t *driver, cc3k_priority_t priority)
+{
+  int i;
+
+  for(i=0;i<(int)priority;i++)
+  {
+    if(driver->priority_hold[i] == 0)
+      continue;
+
+    // Let a starved class through now and then
+    if(driver->priority_wait[priority] >= CC3K_PRIORITY_AGING_MS)
+    {
+      driver->stats.priority_aged++;
+      return 1;
+    }
+
+    driver->priority_hold[priority] = CC3K_PRIORITY_HOLD_MS;
+    driver->stats.priority_deferred++;
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Record the outcome of a send attempt for the scheduler
+ */
+static cc3k_status_t _priority_result(cc3k_t *driver, cc3k_priority_t priority, cc3k_status_t status)
+{
+  if(status == CC3K_OK)
+  {
+    driver->priority_hold[priority] = 0;
+    driver->priority_wait[priority] = 0;
+  }
+  else if(status == CC3K_BUSY)
+  {
+    driver->priority_hold[priority] = CC3K_PRIORITY_HOLD_MS;
+  }
+
+  return status;
+}
+
+/**
+ * @brief Age the claims on the link, called from cc3k_loop
+ */
+static void _priority_update(cc3k_t *driver, uint32_t dt)
+{
+  int i;
+
+  for(i=0;i<CC3K_PRIORITY_CLASSES;i++)
+  {
+    if(driver->priority_hold[i] == 0)
+    {
+      driver->priority_wait[i] = 0;
+      continue;
+    }
+
+    driver->priority_hold[i] = dt < driver->priority_hold[i] ? driver->priority_hold[i] - dt : 0;
+
+    if(dt >= 0xFFFFu - driver->priority_wait[i])
+      driver->priority_wait[i] = 0xFFFF;
+    else
+      driver->priority_wait[i] += dt;
+  }
+}
+
+static cc3k_status_t _send_command_now(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t args_length)
 {
   // Check if we are busy processing an existing command
   if( (driver->state != CC3K_STATE_IDLE) || (driver->command != 0) )
@@ -87,6 +163,13 @@ cc3k_status_t cc3k_send_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, u
 
   _int_enable(driver, 0);
 
+  // An interrupt may have started a read since the check above
+  if(driver->state != CC3K_STATE_IDLE)
+  {
+    _int_enable(driver, 1);
+    return CC3K_BUSY;
+  }
+
   if(driver->config->commandCallback)
     (*driver->config->commandCallback)(opcode, arg, args_length);
 
@@ -117,65 +200,476 @@ cc3k_status_t cc3k_send_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, u
   return CC3K_OK;
 }
 
-cc3k_status_t cc3k_send_data(cc3k_t *driver, uint8_t opcode, uint8_t *arg, uint8_t args_length,
+cc3k_status_t cc3k_send_command_priority(cc3k_t *driver, cc3k_priority_t priority, uint16_t opcode, uint8_t *arg, uint8_t args_length)
+{
+  cc3k_status_t status;
+
+  if(!_priority_gate(driver, priority))
+    return CC3K_BUSY;
+
+  status = _send_command_now(driver, opcode, arg, args_length);
+
+  // Refused for the command slot, not the link, so data frames need not
+  // wait for it
+  if(status == CC3K_BUSY && driver->command != 0)
+    return status;
+
+  return _priority_result(driver, priority, status);
+}
+
+cc3k_status_t cc3k_send_command(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t args_length)
+{
+  return cc3k_send_command_priority(driver, cc3k_command_priority(opcode), opcode, arg, args_length);
+}
+
+static cc3k_status_t _send_data_now(cc3k_t *driver, uint8_t opcode, uint8_t *arg, uint8_t args_length,
   uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length)
 {
-  cc3k_data(driver, opcode, arg, args_length, payload, payload_length, footer, footer_length);
+  // Only the SPI link needs to be free. A command response that is still
+  // outstanding arrives later as a frame of its own.
+  if(driver->state != CC3K_STATE_IDLE)
+    return CC3K_BUSY;
+
+  // Every data frame occupies a chip buffer until a free buffer event
+  if(driver->buffers_free == 0)
+  {
+    driver->stats.tx_no_buffer++;
+    return CC3K_BUSY;
+  }
+
+  _int_enable(driver, 0);
+
+  if(driver->state != CC3K_STATE_IDLE || (*driver->config->readInterrupt)() == 0)
+  {
+    // The chip is about to send us something, let that finish first
+    driver->irq_preempt++;
+    _int_enable(driver, 1);
+    return CC3K_BUSY;
+  }
+
+  if(cc3k_data(driver, opcode, arg, args_length, payload, payload_length, footer, footer_length) != CC3K_OK)
+  {
+    _int_enable(driver, 1);
+    return CC3K_INVALID;
+  }
+
+  driver->buffers_free--;
   driver->stats.tx++;
+  driver->stats.bytes_tx += payload_length;
+  if(driver->command != 0)
+    driver->stats.tx_interleaved++;
   _transition(driver, CC3K_STATE_DATA_REQUEST);
+  _int_enable(driver, 1);
   _assert_cs(driver, 1); 
   return CC3K_OK;
 }
 
-cc3k_status_t cc3k_init(cc3k_t *driver, cc3k_config_t *config)
+cc3k_status_t cc3k_send_data_priority(cc3k_t *driver, cc3k_priority_t priority, uint8_t opcode, uint8_t *arg, uint8_t args_length,
+  uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length)
+{
+  if(!_priority_gate(driver, priority))
+    return CC3K_BUSY;
+
+  return _priority_result(driver, priority,
+    _send_data_now(driver, opcode, arg, args_length, payload, payload_length, footer, footer_length));
+}
+
+cc3k_status_t cc3k_send_data(cc3k_t *driver, uint8_t opcode, uint8_t *arg, uint8_t args_length,
+  uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length)
+{
+  return cc3k_send_data_priority(driver, CC3K_PRIORITY_DATA, opcode, arg, args_length,
+    payload, payload_length, footer, footer_length);
+}
+
+static inline int _booting(cc3k_t *driver)
+{
+  return driver->state >= CC3K_STATE_POWER_OFF && driver->state < CC3K_STATE_ERROR;
+}
+
+/**
+ * @brief Wait in the current boot step for a number of milliseconds
+ */
+static inline void _boot_delay(cc3k_t *driver, cc3k_state_t state, uint32_t ms)
+{
+  driver->boot_timer = ms;
+  _transition(driver, state);
+}
+
+/**
+ * @brief Advance the power up sequence
+ *
+ * Each step waits for its delay to run out before doing any work, so
+ * this can be driven from cc3k_loop or from the blocking cc3k_init.
+ */
+static void _boot_update(cc3k_t *driver, uint32_t dt)
 {
   // Patch source parameter to simple link start command
   const uint8_t patch_source = 0x00;
+  uint32_t timeout;
+
+  timeout = driver->config->boot_timeout_ms;
+  if(timeout == 0)
+    timeout = CC3K_BOOT_TIMEOUT_MS;
+
+  driver->boot_elapsed += dt;
+
+  if(driver->boot_elapsed > timeout)
+  {
+    // The chip never came up. Leave it disabled rather than spinning forever.
+#ifdef CC3K_DEBUG
+    fprintf(stderr, "Boot timeout in state %s\n", state_names[driver->state]);
+#endif
+    _int_enable(driver, 0);
+    _assert_cs(driver, 0);
+    _chip_enable(driver, 0);
+    driver->boot_status = CC3K_TIMEOUT;
+    _transition(driver, CC3K_STATE_ERROR);
+    return;
+  }
+
+  if(dt < driver->boot_timer)
+  {
+    driver->boot_timer -= dt;
+    return;
+  }
+  driver->boot_timer = 0;
+
+  switch(driver->state)
+  {
+    case CC3K_STATE_POWER_OFF:
+      _chip_enable(driver, 1);
+      _boot_delay(driver, CC3K_STATE_POWER_ON, 10);
+      break;
+
+    case CC3K_STATE_POWER_ON:
+      _transition(driver, CC3K_STATE_WAIT_READY);
+      // Check the IRQ pin straight away
+      /* fall through */
+
+    case CC3K_STATE_WAIT_READY:
+      // Wait for the interrupt line to fall after enabling the chip
+      if((*driver->config->readInterrupt)() == 0)
+      {
+        // Delay before asserting the CS line
+        _boot_delay(driver, CC3K_STATE_WAIT_CS, 10);
+      }
+      break;
+
+    case CC3K_STATE_WAIT_CS:
+      _assert_cs(driver, 1);
+
+      // The first command sent to the chip is different than the rest, so we will
+      // handle it manually here with synchronous SPI calls.
+      // This will send a CC3K_COMMAND_SIMPLE_LINK_START packet
+
+      // Construct the command packet in the transmit buffer
+      cc3k_command(driver, CC3K_COMMAND_SIMPLE_LINK_START, (uint8_t *)&patch_source, 1);
+      driver->stats.commands++;
+
+      // NOTE Special timing sequence for fist transaction
+      // Send the first 4 bytes of the SPI header, then wait at least 50uS
+      _spi_sync(driver, driver->packet_tx_buffer, driver->packet_rx_buffer, 4);
+      _boot_delay(driver, CC3K_STATE_SIMPLE_LINK_FIRST, 1);
+      break;
+
+    case CC3K_STATE_SIMPLE_LINK_FIRST:
+      // Send the remaining 6 bytes of the COMMAND_SIMPLE_LINK_START packet
+      _spi_sync(driver, driver->packet_tx_buffer+4, driver->packet_rx_buffer + 4, 6);
+
+      // Enable interrupts
+      _int_enable(driver, 1);
+      _assert_cs(driver, 0);
+
+      _transition(driver, CC3K_STATE_SIMPLE_LINK_START);
+      break;
+  }
+}
+
+/**
+ * @brief Point the driver at its SPI buffers
+ */
+static cc3k_status_t _buffers_init(cc3k_t *driver)
+{
+  cc3k_pool_t *pool = driver->config->pool;
+
+  if(pool != NULL)
+  {
+    if(pool->block_size < (CC3K_BUFFER_SIZE))
+      return CC3K_INVALID;
+
+    driver->packet_tx_buffer = cc3k_pool_alloc(pool);
+    driver->packet_rx_buffer = cc3k_pool_alloc(pool);
+
+    if(driver->packet_tx_buffer != NULL && driver->packet_rx_buffer != NULL)
+      return CC3K_OK;
+
+    cc3k_release_buffers(driver);
+    return CC3K_INVALID;
+  }
+
+#if CC3K_STATIC_BUFFERS
+  driver->packet_tx_buffer = driver->packet_tx_storage;
+  driver->packet_rx_buffer = driver->packet_rx_storage;
+  return CC3K_OK;
+#else
+  return CC3K_INVALID;
+#endif
+}
 
+cc3k_status_t cc3k_release_buffers(cc3k_t *driver)
+{
+  cc3k_pool_t *pool = driver->config->pool;
+
+  if(pool != NULL)
+  {
+    if(driver->packet_tx_buffer != NULL)
+      cc3k_pool_free(pool, driver->packet_tx_buffer);
+    if(driver->packet_rx_buffer != NULL)
+      cc3k_pool_free(pool, driver->packet_rx_buffer);
+  }
+
+  driver->packet_tx_buffer = NULL;
+  driver->packet_rx_buffer = NULL;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_rx_loan(cc3k_t *driver, uint8_t *data)
+{
+  cc3k_pool_t *pool = driver->config->pool;
+  uint8_t *buffer = driver->packet_rx_buffer;
+  uint8_t *fresh;
+
+  // Only the frame being delivered can be taken
+  if(pool == NULL || !driver->rx_loanable ||
+    data < buffer || data >= buffer + (CC3K_BUFFER_SIZE))
+    return CC3K_INVALID;
+
+  fresh = cc3k_pool_alloc(pool);
+  if(fresh == NULL)
+  {
+    driver->stats.rx_loan_failures++;
+    return CC3K_INVALID;
+  }
+
+  __atomic_fetch_or(&driver->rx_loaned, (uint32_t)1 << cc3k_pool_index(pool, buffer), __ATOMIC_RELAXED);
+
+  // Nothing in the frame is looked at once the callback returns,
+  // so the driver can switch buffers underneath it
+  driver->packet_rx_buffer = fresh;
+  driver->rx_loanable = 0;
+  driver->stats.rx_loans++;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_rx_release(cc3k_t *driver, uint8_t *data)
+{
+  cc3k_pool_t *pool = driver->config->pool;
+  uint32_t bit;
+  int i;
+
+  if(pool == NULL)
+    return CC3K_INVALID;
+
+  i = cc3k_pool_index(pool, data);
+  if(i < 0)
+    return CC3K_INVALID;
+
+  // Only a block on loan can come back. Anything else, such as a
+  // buffer the driver is still using or one already released, is refused.
+  bit = (uint32_t)1 << i;
+  if((__atomic_fetch_and(&driver->rx_loaned, ~bit, __ATOMIC_RELAXED) & bit) == 0)
+    return CC3K_INVALID_STATE;
+
+  return cc3k_pool_free(pool, data);
+}
+
+cc3k_status_t cc3k_init_async(cc3k_t *driver, cc3k_config_t *config)
+{
   bzero(driver, sizeof(cc3k_t));
 
   driver->config = config;
 
+  if(_buffers_init(driver) != CC3K_OK)
+  {
+    driver->boot_status = CC3K_INVALID;
+    driver->state = CC3K_STATE_ERROR;
+    return CC3K_INVALID;
+  }
+
+  driver->boot_status = CC3K_BUSY;
+
   cc3k_socket_manager_init(driver, &driver->socket_manager);
 
+  if(cc3k_boot_script_init(driver) != CC3K_OK)
+  {
+    driver->boot_status = CC3K_INVALID;
+    driver->state = CC3K_STATE_ERROR;
+    return CC3K_INVALID;
+  }
+
   _int_enable(driver, 0);
 
   _assert_cs(driver, 0);
   _chip_enable(driver, 0);
-  (*config->delayMicroseconds)(100000); 
-  _chip_enable(driver, 1);
-  (*config->delayMicroseconds)(10000); 
+  _boot_delay(driver, CC3K_STATE_POWER_OFF, 100);
 
-  // Wait for the interrupt line to fall after enabling the chip
-  _interrupt_poll_wait(driver);
+  return CC3K_OK;
+}
 
-  // Delay before asserting the CS line
-  (*config->delayMicroseconds)(10000);
-  _assert_cs(driver, 1);
+cc3k_status_t cc3k_init_warm(cc3k_t *driver, cc3k_config_t *config, const cc3k_snapshot_t *snapshot)
+{
+  cc3k_status_t status;
 
-  // The first command sent to the chip is different than the rest, so we will
-  // handle it manually here with synchronous SPI calls.
-  // This will send a CC3K_COMMAND_SIMPLE_LINK_START packet
+  if(snapshot == NULL || !cc3k_snapshot_valid(snapshot))
+  {
+    status = cc3k_init_async(driver, config);
+    driver->stats.warm_fallbacks++;
+    return status;
+  }
 
-  // Construct the command packet in the transmit buffer
-  cc3k_command(driver, CC3K_COMMAND_SIMPLE_LINK_START, (uint8_t *)&patch_source, 1);
-  driver->stats.commands++;
+  bzero(driver, sizeof(cc3k_t));
 
-  // NOTE Special timing sequence for fist transaction
-  // Send the first 4 bytes of the SPI header
-  _spi_sync(driver, driver->packet_tx_buffer, driver->packet_rx_buffer, 4);
-  // Delay for 50uS
-  (*config->delayMicroseconds)(500); 
-  // Send the remaining 6 bytes of the COMMAND_SIMPLE_LINK_START packet
-  _spi_sync(driver, driver->packet_tx_buffer+4, driver->packet_rx_buffer + 4, 6);
+  driver->config = config;
+
+  if(_buffers_init(driver) != CC3K_OK)
+  {
+    driver->boot_status = CC3K_INVALID;
+    driver->state = CC3K_STATE_ERROR;
+    return CC3K_INVALID;
+  }
+
+  driver->boot_status = CC3K_BUSY;
+
+  cc3k_socket_manager_init(driver, &driver->socket_manager);
+
+  if(cc3k_boot_script_warm(driver) != CC3K_OK)
+  {
+    driver->boot_status = CC3K_INVALID;
+    driver->state = CC3K_STATE_ERROR;
+    return CC3K_INVALID;
+  }
+
+  // Data frames in flight when the host went down were either sent or
+  // lost, and the chip reports neither
+  driver->buffers = snapshot->buffers;
+  driver->buffers_free = snapshot->buffers;
+  driver->buffer_size = snapshot->buffer_size;
+  driver->wlan_status = snapshot->wlan_status;
+  driver->dhcp_complete = snapshot->dhcp_complete;
+  driver->ipconfig = snapshot->ipconfig;
+  driver->event_mask = snapshot->event_mask;
+  driver->socket_manager.stale = snapshot->sockets;
+
+  driver->warm = 1;
+  driver->stats.warm_restarts++;
 
-  // Enable interrupts
-  _int_enable(driver, 1);
   _assert_cs(driver, 0);
+  _chip_enable(driver, 1);
+  _transition(driver, CC3K_STATE_IDLE);
+  _int_enable(driver, 1);
 
-  _transition(driver, CC3K_STATE_SIMPLE_LINK_START);
+  // A frame the chip raised before the reset has no edge left to interrupt on
+  if((*config->readInterrupt)() == 0)
+  {
+    _int_enable(driver, 0);
+    cc3k_read_header(driver);
+  }
+  else
+  {
+    cc3k_boot_script_run(driver);
+  }
 
-	return CC3K_OK;	
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_snapshot_save(cc3k_t *driver, cc3k_snapshot_t *snapshot)
+{
+  cc3k_socket_manager_t *socket_manager = &driver->socket_manager;
+  cc3k_socket_t *socket;
+  int i;
+
+  if(!driver->ready)
+    return CC3K_INVALID_STATE;
+
+  bzero(snapshot, sizeof(cc3k_snapshot_t));
+
+  snapshot->magic = CC3K_SNAPSHOT_MAGIC;
+  snapshot->size = sizeof(cc3k_snapshot_t);
+  snapshot->buffers = driver->buffers;
+  snapshot->buffer_size = driver->buffer_size;
+  snapshot->wlan_status = driver->wlan_status;
+  snapshot->dhcp_complete = driver->dhcp_complete;
+  snapshot->ipconfig = driver->ipconfig;
+  snapshot->event_mask = driver->event_mask;
+
+  // Every socket between a successful create and its close holds a descriptor
+  snapshot->sockets = socket_manager->stale;
+  for(i=0;i<CC3K_MAX_SOCKETS;i++)
+  {
+    socket = socket_manager->socket[i];
+    if(socket == NULL || socket->sd >= 32)
+      continue;
+
+    if(socket->state >= SOCKET_STATE_CREATED && socket->state <= SOCKET_STATE_CLOSE_WAIT)
+      snapshot->sockets |= (1<<socket->sd);
+  }
+
+  snapshot->checksum = cc3k_checksum(snapshot, offsetof(cc3k_snapshot_t, checksum));
+
+  return CC3K_OK;
+}
+
+int cc3k_snapshot_valid(const cc3k_snapshot_t *snapshot)
+{
+  return snapshot->magic == CC3K_SNAPSHOT_MAGIC &&
+    snapshot->size == sizeof(cc3k_snapshot_t) &&
+    snapshot->checksum == cc3k_checksum(snapshot, offsetof(cc3k_snapshot_t, checksum));
+}
+
+uint32_t cc3k_checksum(const void *data, uint32_t length)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t hash = 2166136261u;
+  uint32_t i;
+
+  for(i=0;i<length;i++)
+  {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+cc3k_status_t cc3k_init(cc3k_t *driver, cc3k_config_t *config)
+{
+  if(cc3k_init_async(driver, config) != CC3K_OK)
+    return driver->boot_status;
+
+  // Run the same boot steps, sleeping a millisecond at a time
+  while(_booting(driver))
+  {
+    (*config->delayMicroseconds)(1000);
+    _boot_update(driver, 1);
+  }
+
+  if(driver->state == CC3K_STATE_ERROR)
+    return driver->boot_status;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_boot_status(cc3k_t *driver)
+{
+  if(driver->state == CC3K_STATE_ERROR)
+    return driver->boot_status;
+
+  if(!driver->ready)
+    return CC3K_BUSY;
+
+  return CC3K_OK;
 }
 
 cc3k_status_t cc3k_set_network(cc3k_t *driver, cc3k_security_type_t security_type, char *ssid, uint8_t ssid_length, char *key, uint8_t key_length)
@@ -227,14 +721,26 @@ cc3k_status_t cc3k_wlan_connect(
 static cc3k_status_t cc3k_read_header(cc3k_t *driver)
 {
   cc3k_spi_header_t *spi_header;
+  uint16_t length;
+
   spi_header = (cc3k_spi_header_t *)driver->packet_tx_buffer;
   spi_header->type = CC3K_PACKET_TYPE_READ;
   spi_header->length = 0;
   spi_header->busy = 0;
 
+  // Read past the header when configured, so short frames
+  // arrive complete in this one transfer
+  length = driver->config->speculative_read;
+  if(length < CC3K_READ_HEADER_SIZE)
+    length = CC3K_READ_HEADER_SIZE;
+  if(length > (CC3K_BUFFER_SIZE))
+    length = (CC3K_BUFFER_SIZE);
+
+  driver->packet_rx_buffer_length = length;
+
   _transition(driver, CC3K_STATE_READ_HEADER);
   _assert_cs(driver, 1);
-  _spi(driver, driver->packet_tx_buffer, driver->packet_rx_buffer, 10);
+  _spi(driver, driver->packet_tx_buffer, driver->packet_rx_buffer, length);
   return CC3K_OK;
 }
 
@@ -247,6 +753,7 @@ cc3k_status_t cc3k_spi_done(cc3k_t *driver)
   // This could be from a DMA interrupt handler
   // Or a busy wait in the SPI transaction callback
 
+  driver->stats_seq++;
   driver->spi_busy = 0;
 
   switch(driver->state)
@@ -257,11 +764,18 @@ cc3k_status_t cc3k_spi_done(cc3k_t *driver)
       length = HI(spi_rx_header->length);
       length |= LO(spi_rx_header->length);
 
-      // Check if there is more SPI packet payload to receive (we already received the 5 byte minimum)
-      if(length - 5 > 0)
+      // Total frame size including the SPI header, limited to what fits in the buffer
+      length += sizeof(cc3k_spi_rx_header_t);
+      if(length > (CC3K_BUFFER_SIZE))
+        length = (CC3K_BUFFER_SIZE);
+
+      // Check if there is more SPI packet payload to receive than the first transfer clocked in
+      if(length > driver->packet_rx_buffer_length)
       {
+        driver->stats.rx_split_transfer++;
         _transition(driver, CC3K_STATE_READ_PAYLOAD);
-        _spi(driver, driver->packet_tx_buffer, driver->packet_rx_buffer + sizeof(cc3k_spi_rx_header_t) + 5, length-5);
+        _spi(driver, driver->packet_tx_buffer, driver->packet_rx_buffer + driver->packet_rx_buffer_length,
+          length - driver->packet_rx_buffer_length);
       }
       else
       {
@@ -269,6 +783,7 @@ cc3k_status_t cc3k_spi_done(cc3k_t *driver)
         _int_enable(driver, 1);
         _assert_cs(driver, 0);
 
+        driver->stats.rx_single_transfer++;
         driver->stats.events++;
         _transition(driver, CC3K_STATE_IDLE);
         _process_event(driver);
@@ -286,7 +801,9 @@ cc3k_status_t cc3k_spi_done(cc3k_t *driver)
       break;
 
     case CC3K_STATE_SEND_COMMAND:
-      _transition(driver, CC3K_STATE_COMMAND);
+      // The link is free again. driver->command stays set until the
+      // response arrives, which keeps further commands out meanwhile.
+      _transition(driver, CC3K_STATE_IDLE);
       
       // Re-enable interrupts to get notification of a response,
       // or an unsolicited event
@@ -294,8 +811,13 @@ cc3k_status_t cc3k_spi_done(cc3k_t *driver)
       _assert_cs(driver, 0);
       break;
     case CC3K_STATE_DATA:
-      // SPI transmission has completed, deassert /CS and wait for
+      // SPI transmission has completed. The chip does not answer data
+      // frames, so the link is free for the next transfer.
+      _transition(driver, CC3K_STATE_IDLE);
+      _int_enable(driver, 1);
       _assert_cs(driver, 0);
+
+      cc3k_socket_tx_done(&driver->socket_manager);
       break;
 
     default:
@@ -315,6 +837,7 @@ cc3k_status_t cc3k_interrupt(cc3k_t *driver)
   fprintf(stderr, "Interrupt state %s\n", state_names[driver->state]);
 #endif
 
+  driver->stats_seq++;
   driver->stats.interrupts++;
 
   driver->int_state = driver->state;
@@ -378,145 +901,410 @@ static cc3k_status_t _process_data(cc3k_t *driver, cc3k_data_header_t *data_head
 
 #ifdef CC3K_DEBUG
   fprintf(stderr, "Bytes %d\n", data_header->payload_length);
-  fprintf(stderr, "Received %d packets %d bytes\n", driver->stats.rx, driver->stats.bytes_rx);
+  fprintf(stderr, "Received %lu packets %lu bytes\n", (unsigned long)driver->stats.rx, (unsigned long)driver->stats.bytes_rx);
 #endif
 
   switch(data_header->opcode)
   {
+    case CC3K_DATA_RECV:
     case CC3K_DATA_RECVFROM:
-      recvfrom_header = ((uint8_t *)data_header) + sizeof(cc3k_data_header_t);
+      // Both carry the descriptor and length in the same argument block
+      recvfrom_header = (cc3k_data_recvfrom_t *)(((uint8_t *)data_header) + sizeof(cc3k_data_header_t));
       sd = recvfrom_header->sd;
       frame_length = recvfrom_header->payload_length;
       frame = ((uint8_t *)recvfrom_header) + data_header->argument_length;
       break;
-    case CC3K_DATA_RECV:
+
+    case CC3K_DATA_NVMEM_READ:
+      // The payload length counts the arguments as well
+      if(data_header->payload_length >= data_header->argument_length)
+      {
+        cc3k_identity_nvmem_event(driver,
+          ((uint8_t *)data_header) + sizeof(cc3k_data_header_t) + data_header->argument_length,
+          data_header->payload_length - data_header->argument_length);
+      }
+      break;
+  }
+
+  if(frame != NULL)
+  {
+    // Pass the data to the socket manager, whose callback may keep the buffer
+    driver->rx_loanable = 1;
+    cc3k_socket_data_event(&driver->socket_manager, sd, frame, frame_length, from);
+    driver->rx_loanable = 0;
+  }
+
+  return CC3K_OK;
+}
+
+static cc3k_status_t _process_event(cc3k_t *driver)
+{
+  cc3k_command_header_t *event_header;
+  uint8_t *payload;
+  uint16_t opcode;
+  
+  event_header = (cc3k_command_header_t *)(driver->packet_rx_buffer + sizeof(cc3k_spi_rx_header_t));
+
+#ifdef CC3K_DEBUG
+  fprintf(stderr, "Processing event type %04X\n", event_header->type);
+#endif
+
+  if(event_header->type == CC3K_PAYLOAD_TYPE_DATA)
+  {
+    cc3k_data_header_t *data_header;
+    data_header = (cc3k_data_header_t *)event_header;
+    _process_data(driver, data_header);
+    
+    return CC3K_OK;
+  }
+
+  if(event_header->type != CC3K_PAYLOAD_TYPE_EVENT)
+  {
+#ifdef CC3K_DEBUG
+    fprintf(stderr, "Buffer does not contain data or event!\n");
+#endif
+    return CC3K_INVALID;
+  }
+
+  payload = driver->packet_rx_buffer + sizeof(cc3k_spi_rx_header_t) + sizeof(cc3k_command_header_t);
+
+  if(driver->config->eventCallback)
+    (*driver->config->eventCallback)(event_header->opcode, payload, event_header->argument_length);
+
+#ifdef CC3K_DEBUG
+  fprintf(stderr, "Event opcode 0x%04X\n", event_header->opcode);
+#endif
+
+  if(event_header->opcode >= 0x4100)
+  {
+    // Async unsolocited event
+    driver->stats.unsolicited++;
+
+    switch(event_header->opcode)
+    {
+      case CC3K_EVENT_KEEPALIVE:
+        driver->stats.keepalive_events++;
+        break;
+      case CC3K_EVENT_PING_REPORT:
+        driver->stats.ping_report_events++;
+        break;
+      case CC3K_EVENT_FREE_BUFFER:
+        driver->stats.free_buffer_events++;
+        break;
+    }
+
+    // A command response that is still outstanding is tracked by
+    // driver->command, the link itself stays idle
+    _assert_cs(driver, 0);
+  }
+  else
+  {
+    cc3k_recv_event_t *recv_event;
+    cc3k_wlan_connect_event_t *conn_event;
+
+    // This event should be a response to the last sent command
+    //if(event_header->opcode != driver->command)
+      //return CC3K_INVALID;
+
+    // This is a response to the pending command.
+    // Reset the pending command in the driver for the unsolicited event logic
+
+    if(event_header->opcode == driver->command)
+      driver->command = 0;
+
+    _assert_cs(driver, 0);
+
+    switch(event_header->opcode)
+    {
+      case CC3K_COMMAND_WLAN_CONNECT:
+        // This is a response to the wlan connect command
+        conn_event = (cc3k_wlan_connect_event_t *)payload;
+        if(conn_event->result < 0)
+        {
+          // Connect command failed
+          driver->wlan_status = WLAN_STATUS_DISCONNECTED;
+        } 
+        break;
+      case CC3K_COMMAND_RECV:
+      case CC3K_COMMAND_RECVFROM:
+        recv_event = (cc3k_recv_event_t *)payload;
+
+#ifdef CC3K_DEBUG
+        fprintf(stderr, "Recv %d len %d flags 0x%08X\n", recv_event->sd, recv_event->length, recv_event->flags);
+#endif
+
+        if(recv_event->length > 0)
+          _transition(driver, CC3K_STATE_DATA_RX);
+
+        break;
+      default:
+        break;
+    }
+  }
+
+  // The handlers may issue the next command, which clears the receive buffer
+  opcode = event_header->opcode;
+
+  cc3k_process_event(driver, opcode, payload, event_header->argument_length);
+
+  // Issue the next bring-up command once this response has been consumed
+  if(opcode < 0x4100)
+    cc3k_boot_script_response(driver, opcode);
+ 
+  return CC3K_OK; 
+}
+
+/**
+ * @brief Read a frame whose interrupt was missed
+ *
+ * @return 1 if the chip had something waiting
+ */
+static int _watchdog_reread(cc3k_t *driver)
+{
+  switch(driver->state)
+  {
+    case CC3K_STATE_DATA:
+    case CC3K_STATE_DATA_RX:
+    case CC3K_STATE_COMMAND:
+    case CC3K_STATE_IDLE:
       break;
+    default:
+      return 0;
+  }
+
+  if((*driver->config->readInterrupt)() != 0)
+    return 0;
+
+  driver->stats.recover_rereads++;
+
+  _int_enable(driver, 0);
+  cc3k_read_header(driver);
+  return 1;
+}
+
+/**
+ * @brief Fail lookups and option reads the application is waiting on
+ */
+static void _watchdog_fail_pending(cc3k_t *driver)
+{
+  if(driver->dns_pending)
+  {
+    driver->dns_result = -1;
+    driver->dns_pending = 0;
   }
 
-  if(frame != NULL)
+  if(driver->sockopt_pending)
+  {
+    driver->sockopt_status = -1;
+    driver->sockopt_pending = 0;
+  }
+}
+
+/**
+ * @brief Abandon the outstanding command and return the SPI link to idle
+ *
+ * Must not be called while a transfer is in flight, see spi_busy.
+ */
+static void _watchdog_resync(cc3k_t *driver)
+{
+  driver->stats.recover_resyncs++;
+
+  _int_enable(driver, 0);
+  _assert_cs(driver, 0);
+
+  driver->spi_busy = 0;
+  driver->command = 0;
+  _transition(driver, CC3K_STATE_IDLE);
+
+  _watchdog_fail_pending(driver);
+
+  cc3k_socket_abort(&driver->socket_manager);
+
+  _int_enable(driver, 1);
+}
+
+/**
+ * @brief Restart the chip from power off
+ *
+ * The network settings, sockets and statistics survive, everything
+ * else starts over as if cc3k_init_async had been called.
+ */
+static void _watchdog_power_cycle(cc3k_t *driver)
+{
+  cc3k_socket_manager_t socket_manager = driver->socket_manager;
+  cc3k_stats_t stats = driver->stats;
+  cc3k_rate_window_t rate_window = driver->rate_window;
+  cc3k_ipconfig_t static_ip = driver->static_ip;
+  uint8_t static_ip_enabled = driver->static_ip_enabled;
+  uint8_t static_ip_active = driver->static_ip_active;
+  uint8_t static_ip_write = driver->static_ip_write;
+  uint32_t last_time_ms = driver->last_time_ms;
+  uint8_t watchdog_level = driver->watchdog_level;
+  uint32_t event_mask = driver->event_mask;
+  int32_t dns_result;
+  int8_t sockopt_status;
+  uint32_t rx_loaned = driver->rx_loaned;
+  cc3k_ping_t ping = driver->ping;
+  cc3k_status_t status;
+
+  cc3k_security_type_t security_type = driver->security_type;
+  char ssid[CC3K_SSID_MAX];
+  uint8_t ssid_length = driver->ssid_length;
+  char key[CC3K_KEY_MAX];
+  uint8_t key_length = driver->key_length;
+
+  memcpy(ssid, driver->ssid, CC3K_SSID_MAX);
+  memcpy(key, driver->key, CC3K_KEY_MAX);
+
+  _watchdog_fail_pending(driver);
+  dns_result = driver->dns_result;
+  sockopt_status = driver->sockopt_status;
+
+  cc3k_release_buffers(driver);
+  status = cc3k_init_async(driver, driver->config);
+
+  driver->socket_manager = socket_manager;
+  driver->stats = stats;
+  driver->rate_window = rate_window;
+  driver->static_ip = static_ip;
+  driver->static_ip_enabled = static_ip_enabled;
+  driver->static_ip_active = static_ip_active;
+  driver->static_ip_write = static_ip_write;
+  driver->last_time_ms = last_time_ms;
+  driver->watchdog_level = watchdog_level;
+  driver->watchdog_events = stats.events;
+  driver->dns_result = dns_result;
+  driver->sockopt_status = sockopt_status;
+  driver->rx_loaned = rx_loaned;
+  driver->ping = ping;
+  cc3k_ping_reset(driver);
+
+  // The bring-up step reads the mask through the pointer, so a mask set
+  // at runtime is applied in place of the configured one
+  driver->event_mask = event_mask;
+  if(status == CC3K_OK && event_mask != 0 && driver->config->event_mask == 0)
+    status = cc3k_boot_script_add(driver, CC3K_COMMAND_SET_EVENT_MASK, (const uint8_t *)&driver->event_mask, sizeof(uint32_t));
+
+  cc3k_set_network(driver, security_type, ssid, ssid_length, key, key_length);
+
+  cc3k_socket_manager_reset(&driver->socket_manager);
+
+  // A bring-up that cannot be scripted would only fail on the chip
+  if(status != CC3K_OK)
   {
-    // Pass the data to the socket manager
-    return cc3k_socket_data_event(&driver->socket_manager, sd, frame, frame_length, from);
+    _int_enable(driver, 0);
+    driver->boot_status = CC3K_INVALID;
+    driver->state = CC3K_STATE_ERROR;
   }
-
-  return CC3K_OK;
 }
 
-static cc3k_status_t _process_event(cc3k_t *driver)
+/**
+ * @brief Recover from a command or transfer the chip never completed
+ *
+ * Each timeout escalates one step: read a frame whose interrupt was
+ * missed, then abandon the command, then power cycle the chip. Any frame
+ * from the chip drops back to the first step.
+ */
+static void _watchdog(cc3k_t *driver, uint32_t dt)
 {
-  cc3k_command_header_t *event_header;
-  uint8_t *payload;
-  
-  event_header = (cc3k_command_header_t *)(driver->packet_rx_buffer + sizeof(cc3k_spi_rx_header_t));
+  uint32_t timeout;
 
-#ifdef CC3K_DEBUG
-  fprintf(stderr, "Processing event type %04X\n", event_header->type);
-#endif
+  // A chip that never booted is left for the application to deal with,
+  // one that stopped responding is power cycled until it comes back
+  if(driver->state == CC3K_STATE_ERROR && driver->watchdog_level < 2)
+    return;
 
-  if(event_header->type == CC3K_PAYLOAD_TYPE_DATA)
+  if(driver->stats.events != driver->watchdog_events)
   {
-    cc3k_data_header_t *data_header;
-    data_header = (cc3k_data_header_t *)event_header;
-    _process_data(driver, data_header);
-    
-    return CC3K_OK;
+    // The chip is talking to us. Commands chained from the interrupt
+    // handler can share an opcode, so progress also restarts the clock.
+    driver->watchdog_events = driver->stats.events;
+    driver->watchdog_level = 0;
+    driver->watchdog_deferred = 0;
+    driver->watchdog_timer = 0;
   }
 
-  if(event_header->type != CC3K_PAYLOAD_TYPE_EVENT)
+  if(driver->state == CC3K_STATE_IDLE && driver->command == 0)
   {
-#ifdef CC3K_DEBUG
-    fprintf(stderr, "Buffer does not contain data or event!\n");
-#endif
-    return CC3K_INVALID;
+    // Nothing outstanding
+    driver->watchdog_timer = 0;
+    return;
   }
 
-  payload = driver->packet_rx_buffer + sizeof(cc3k_spi_rx_header_t) + sizeof(cc3k_command_header_t);
-
-  if(driver->config->eventCallback)
-    (*driver->config->eventCallback)(event_header->opcode, payload, event_header->argument_length);
-
-#ifdef CC3K_DEBUG
-  fprintf(stderr, "Event opcode 0x%04X\n", event_header->opcode);
-#endif
-
-  if(event_header->opcode >= 0x4100)
+  if(driver->command != driver->watchdog_command)
   {
-    // Async unsolocited event
-    driver->stats.unsolicited++;
-
-    // Check if we were waiting for a command before the unsolicited event arrived
-    // This will cause a transition back to the COMMAND state to wait for
-    // the response to the original command request
+    // A new command restarts the clock
+    driver->watchdog_command = driver->command;
+    driver->watchdog_timer = 0;
+  }
 
-    // We remain in this state to prevent other commands from being sent until this one
-    // has completed. We *might* be able to interleave some commands but will leave that for later
-    if(driver->command != 0)
-      _transition(driver, CC3K_STATE_COMMAND);
+  driver->watchdog_timer += dt;
 
-    _assert_cs(driver, 0);
-  }
-  else
-  {
-    cc3k_recv_event_t *recv_event;
-    cc3k_wlan_connect_event_t *conn_event;
+  timeout = driver->config->command_timeout_ms;
+  if(timeout == 0)
+    timeout = CC3K_COMMAND_TIMEOUT_MS;
 
-    // This event should be a response to the last sent command
-    //if(event_header->opcode != driver->command)
-      //return CC3K_INVALID;
+  // The chip holds on to select commands for up to their own timeout
+  if(driver->command == CC3K_COMMAND_SELECT)
+    timeout += CC3K_SELECT_TIMEOUT_MS;
 
-    // This is a response to the pending command.
-    // Reset the pending command in the driver for the unsolicited event logic
+  // to connects to a host that does not answer
+  if(driver->command == CC3K_COMMAND_CONNECT)
+    timeout += CC3K_CONNECT_TIMEOUT_MS;
 
-    if(event_header->opcode == driver->command)
-      driver->command = 0;
+  // and receives on a socket with a receive timeout for up to that long
+  if(driver->command == CC3K_COMMAND_RECV || driver->command == CC3K_COMMAND_RECVFROM)
+    timeout += driver->socket_manager.recv_timeout_ms;
 
-    _assert_cs(driver, 0);
+  if(driver->watchdog_timer < timeout)
+    return;
 
-    // Handle the first simple link start command and kickoff a read_buffer_size
-    switch(event_header->opcode)
-    {
-      case CC3K_COMMAND_SIMPLE_LINK_START:
-        cc3k_set_debug(driver, CC3K_DEBUG_MASK);
-        break;
-      case CC3K_COMMAND_NETAPP_SET_DEBUG:
-        cc3k_send_command(driver, CC3K_COMMAND_READ_BUFFER_SIZE, NULL, 0);
-        break;
-      case CC3K_COMMAND_WLAN_CONNECT:
-        // This is a response to the wlan connect command
-        conn_event = (cc3k_wlan_connect_event_t *)payload;
-        if(conn_event->result < 0)
-        {
-          // Connect command failed
-          driver->wlan_status = WLAN_STATUS_DISCONNECTED;
-        } 
-        break;
-      case CC3K_COMMAND_RECV:
-      case CC3K_COMMAND_RECVFROM:
-        recv_event = (cc3k_recv_event_t *)payload;
+  driver->watchdog_timer = 0;
 
 #ifdef CC3K_DEBUG
-        fprintf(stderr, "Recv %d len %d flags 0x%08X\n", recv_event->sd, recv_event->length, recv_event->flags);
+  fprintf(stderr, "Watchdog level %d in state %s command 0x%04X\n",
+    driver->watchdog_level, state_names[driver->state], driver->command);
 #endif
 
-        if(recv_event->length > 0)
-          _transition(driver, CC3K_STATE_DATA_RX);
+  switch(driver->watchdog_level)
+  {
+    case 0:
+      driver->watchdog_level++;
+      if(_watchdog_reread(driver))
+        break;
+      // Nothing to read, go straight to the next step
+      /* fall through */
 
+    case 1:
+      // Deselecting the chip under a DMA transfer would corrupt it, so a
+      // transfer in flight gets one more timeout to finish
+      if(driver->spi_busy && !driver->watchdog_deferred)
+      {
+        driver->watchdog_deferred = 1;
         break;
-      default:
+      }
+
+      if(!driver->spi_busy)
+      {
+        driver->watchdog_level++;
+        _watchdog_resync(driver);
         break;
-    }
-  }
+      }
+      // The transfer is stuck, only a power cycle will recover
+      /* fall through */
 
-  cc3k_process_event(driver, event_header->opcode, payload, event_header->argument_length);
- 
-  return CC3K_OK; 
+    default:
+      _watchdog_power_cycle(driver);
+      driver->stats.recover_power_cycles++;
+      break;
+  }
 }
 
 cc3k_status_t cc3k_loop(cc3k_t *driver, uint32_t time_ms)
 {
   /** Milliseconds elapsed since last loop iteration */
   uint32_t dt;
-  cc3k_status_t status;
+  int wlan_retry;
 
   if(driver->last_time_ms == 0)
   {
@@ -529,6 +1317,51 @@ cc3k_status_t cc3k_loop(cc3k_t *driver, uint32_t time_ms)
 
   driver->last_time_ms = time_ms;
 
+  cc3k_stats_update(driver, dt);
+  _priority_update(driver, dt);
+
+  // Power up the chip when started with cc3k_init_async. The
+  // boot timeout also covers waiting for the simple link start response.
+  if(_booting(driver) || driver->state == CC3K_STATE_SIMPLE_LINK_START)
+  {
+    _boot_update(driver, dt);
+    driver->last_state = driver->state;
+    return CC3K_OK;
+  }
+
+  // Bound the time spent waiting on the chip
+  _watchdog(driver, dt);
+  if(_booting(driver))
+  {
+    driver->last_state = driver->state;
+    return CC3K_OK;
+  }
+
+  // Count down the delay before the next association attempt
+  wlan_retry = cc3k_backoff_elapsed(&driver->wlan_backoff, dt);
+
+  if(!driver->ready)
+  {
+    driver->boot_elapsed += dt;
+
+    // The chip did not survive the host reset after all
+    if(driver->warm && driver->boot_elapsed > CC3K_WARM_TIMEOUT_MS)
+    {
+      _watchdog_power_cycle(driver);
+      driver->stats.warm_fallbacks++;
+      driver->last_state = driver->state;
+      return CC3K_OK;
+    }
+
+    // Bring-up steps are normally chained from the response handler.
+    // Retry here if one could not be issued at the time.
+    if(driver->state == CC3K_STATE_IDLE)
+      cc3k_boot_script_run(driver);
+
+    driver->last_state = driver->state;
+    return CC3K_OK;
+  }
+
   switch(driver->state)
   {
     case CC3K_STATE_IDLE:
@@ -542,15 +1375,27 @@ cc3k_status_t cc3k_loop(cc3k_t *driver, uint32_t time_ms)
       }
 */
 
-      if(driver->wlan_status == WLAN_STATUS_DISCONNECTED && driver->ssid_length > 0)
+      if(driver->wlan_status == WLAN_STATUS_DISCONNECTED && driver->ssid_length > 0 && wlan_retry)
       {
         //if(cc3k_wlan_connect(driver, CC3K_SEC_WPA2, SSID, strlen(SSID), KEY, strlen(KEY)) == CC3K_OK)
         if(cc3k_wlan_connect(driver, CC3K_SEC_WPA2, driver->ssid, driver->ssid_length, driver->key, driver->key_length) == CC3K_OK)
         {
           driver->dhcp_complete = 0;
+          driver->stats.wifi_connections++;
+          if(driver->wlan_backoff.attempts > 0)
+            driver->stats.wlan_retries++;
+
+          // Hold off the next attempt in case this one fails. The backoff
+          // is reset once the association succeeds.
+          cc3k_backoff_next(driver, &driver->wlan_backoff, &driver->config->wlan_backoff);
         }
       }
 
+      // The chip came up with another address, store the static one
+      // for its next power up
+      if(driver->static_ip_write && driver->command == 0)
+        cc3k_set_static_ip(driver, &driver->static_ip);
+
       break;
 
     default:
@@ -561,7 +1406,17 @@ cc3k_status_t cc3k_loop(cc3k_t *driver, uint32_t time_ms)
   // Run the socket manager
   if( (driver->wlan_status == WLAN_STATUS_CONNECTED) &&
       (driver->dhcp_complete == 1) )
+  {
+    // A ping round that is due goes ahead of the next select, which
+    // would otherwise always take the command slot first
+    cc3k_ping_update(driver, dt);
     cc3k_socket_manager_loop(&driver->socket_manager, dt);
+  }
+  else
+  {
+    // Nothing to close on the chip, removed sockets can go now
+    cc3k_socket_manager_offline(&driver->socket_manager);
+  }
 
   driver->last_state = driver->state;
 
@@ -573,6 +1428,125 @@ cc3k_status_t cc3k_set_debug(cc3k_t *driver, uint32_t level)
   return cc3k_send_command(driver, CC3K_COMMAND_NETAPP_SET_DEBUG, (uint8_t *)&level, sizeof(uint32_t));
 }
 
+cc3k_status_t cc3k_set_event_mask(cc3k_t *driver, uint32_t mask)
+{
+  cc3k_status_t status;
+
+  mask = cc3k_event_mask_filter(driver, mask);
+
+  status = cc3k_send_command(driver, CC3K_COMMAND_SET_EVENT_MASK, (uint8_t *)&mask, sizeof(uint32_t));
+  if(status == CC3K_OK)
+    driver->event_mask = mask;
+
+  return status;
+}
+
+uint32_t cc3k_event_mask_filter(cc3k_t *driver, uint32_t mask)
+{
+  mask &= ~CC3K_EVENT_MASK_REQUIRED;
+
+  // The monitor would count every round as lost
+  if(driver->config->ping.interval_ms != 0)
+    mask &= ~CC3K_EVENT_PING_REPORT;
+
+  return mask;
+}
+
+void cc3k_netapp_dhcp_args(cc3k_command_netapp_dhcp_t *cmd, const cc3k_ipconfig_t *ipconfig)
+{
+  bzero(cmd, sizeof(cc3k_command_netapp_dhcp_t));
+
+  if(ipconfig != NULL)
+  {
+    cmd->ip = ipconfig->ip;
+    cmd->netmask = ipconfig->netmask;
+    cmd->default_gateway = ipconfig->default_gateway;
+    cmd->dns_server = ipconfig->dns_server;
+  }
+}
+
+static uint32_t _netapp_timer(uint32_t seconds)
+{
+  // Zero disables the timer, anything else has a lower limit on the chip
+  if(seconds != 0 && seconds < CC3K_NETAPP_TIMER_MIN)
+    return CC3K_NETAPP_TIMER_MIN;
+  return seconds;
+}
+
+void cc3k_netapp_timers_args(cc3k_command_netapp_set_timers_t *cmd, const cc3k_netapp_timers_t *timers)
+{
+  cmd->dhcp = _netapp_timer(timers->dhcp);
+  cmd->arp = _netapp_timer(timers->arp);
+  cmd->keepalive = _netapp_timer(timers->keepalive);
+  cmd->inactivity = _netapp_timer(timers->inactivity);
+}
+
+int cc3k_static_ip_match(cc3k_t *driver)
+{
+  // The DHCP server field means nothing for a static address
+  return driver->dhcp_complete &&
+    driver->ipconfig.ip == driver->static_ip.ip &&
+    driver->ipconfig.netmask == driver->static_ip.netmask &&
+    driver->ipconfig.default_gateway == driver->static_ip.default_gateway &&
+    driver->ipconfig.dns_server == driver->static_ip.dns_server;
+}
+
+cc3k_status_t cc3k_set_static_ip(cc3k_t *driver, const cc3k_ipconfig_t *ipconfig)
+{
+  cc3k_command_netapp_dhcp_t cmd;
+  cc3k_status_t status;
+
+  // Every write goes to NVMEM, so leave an address the chip already uses
+  if(ipconfig != NULL)
+  {
+    driver->static_ip = *ipconfig;
+    driver->static_ip_enabled = 1;
+    driver->static_ip_write = 0;
+    if(cc3k_static_ip_match(driver))
+    {
+      driver->static_ip_active = 1;
+      return CC3K_OK;
+    }
+  }
+
+  cc3k_netapp_dhcp_args(&cmd, ipconfig);
+
+  status = cc3k_send_command(driver, CC3K_COMMAND_NETAPP_DHCP, (uint8_t *)&cmd, sizeof(cc3k_command_netapp_dhcp_t));
+  if(status != CC3K_OK)
+  {
+    // Try again from the loop
+    if(ipconfig != NULL)
+      driver->static_ip_write = 1;
+    return status;
+  }
+
+  // Not in effect until the chip reports it after a power up
+  driver->static_ip_active = 0;
+
+  if(ipconfig == NULL)
+    driver->static_ip_enabled = 0;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_set_timers(cc3k_t *driver, const cc3k_netapp_timers_t *timers)
+{
+  cc3k_command_netapp_set_timers_t cmd;
+
+  cc3k_netapp_timers_args(&cmd, timers);
+
+  return cc3k_send_command(driver, CC3K_COMMAND_NETAPP_SET_TIMERS, (uint8_t *)&cmd, sizeof(cc3k_command_netapp_set_timers_t));
+}
+
+cc3k_status_t cc3k_get_ipconfig(cc3k_t *driver, cc3k_ipconfig_t *ipconfig)
+{
+  if(driver->dhcp_complete == 0)
+    return CC3K_INVALID_STATE;
+
+  *ipconfig = driver->ipconfig;
+  return CC3K_OK;
+}
+
 /**
  * Chip socket command functions
  */
@@ -633,11 +1607,12 @@ cc3k_status_t cc3k_select(cc3k_t *driver, uint8_t maxfd, uint32_t read_fd, uint3
   cmd.read_fd = read_fd;
   cmd.write_fd = write_fd;
   cmd.except_fd = except_fd;
-  cmd.timeout_sec = 1;
-  cmd.timeout_usec = 0; //250000; 
+  cmd.timeout_sec = CC3K_SELECT_TIMEOUT_MS / 1000;
+  cmd.timeout_usec = (CC3K_SELECT_TIMEOUT_MS % 1000) * 1000;
 
 
-  status = cc3k_send_command(driver, CC3K_COMMAND_SELECT, (uint8_t *)&cmd, sizeof(cc3k_command_select_t));
+  status = cc3k_send_command_priority(driver, CC3K_PRIORITY_BACKGROUND,
+    CC3K_COMMAND_SELECT, (uint8_t *)&cmd, sizeof(cc3k_command_select_t));
 
   
 #ifdef CC3K_DEBUG
@@ -650,13 +1625,76 @@ cc3k_status_t cc3k_select(cc3k_t *driver, uint8_t maxfd, uint32_t read_fd, uint3
   return status;
 }
 
+cc3k_status_t cc3k_nvmem_read(cc3k_t *driver, uint32_t file_id, uint32_t length, uint32_t offset)
+{
+  cc3k_command_nvmem_read_t cmd;
+
+  cmd.file_id = file_id;
+  cmd.length = length;
+  cmd.offset = offset;
+
+  return cc3k_send_command(driver, CC3K_COMMAND_NVMEM_READ, (uint8_t *)&cmd, sizeof(cc3k_command_nvmem_read_t));
+}
+
+cc3k_status_t cc3k_read_sp_version(cc3k_t *driver)
+{
+  return cc3k_send_command(driver, CC3K_COMMAND_READ_SP_VERSION, NULL, 0);
+}
+
+cc3k_status_t cc3k_setsockopt(cc3k_t *driver, int sd, uint32_t level, uint32_t optname, const uint8_t *optval, uint8_t optlen)
+{
+  cc3k_command_setsockopt_t cmd;
+
+  if(optlen > CC3K_SOCKOPT_MAX)
+    return CC3K_INVALID;
+
+  cmd.sd = sd;
+  cmd.level = level;
+  cmd.optname = optname;
+  cmd.offset = 0x08;
+  cmd.optlen = optlen;
+  bzero(cmd.optval, CC3K_SOCKOPT_MAX);
+  memcpy(cmd.optval, optval, optlen);
+
+  return cc3k_send_command(driver, CC3K_COMMAND_SETSOCKOPT, (uint8_t *)&cmd, sizeof(cc3k_command_setsockopt_t));
+}
+
+cc3k_status_t cc3k_getsockopt(cc3k_t *driver, int sd, uint32_t level, uint32_t optname)
+{
+  cc3k_command_getsockopt_t cmd;
+  cc3k_status_t status;
+
+  if(driver->sockopt_pending)
+    return CC3K_BUSY;
+
+  cmd.sd = sd;
+  cmd.level = level;
+  cmd.optname = optname;
+
+  // Set first, the response can arrive before the send returns
+  driver->sockopt_pending = 1;
+
+  status = cc3k_send_command(driver, CC3K_COMMAND_GETSOCKOPT, (uint8_t *)&cmd, sizeof(cc3k_command_getsockopt_t));
+  if(status != CC3K_OK)
+    driver->sockopt_pending = 0;
+
+  return status;
+}
+
+cc3k_status_t cc3k_getmss(cc3k_t *driver, int sd)
+{
+  uint32_t s = sd;
+  return cc3k_send_command(driver, CC3K_COMMAND_GETMSS, (uint8_t *)&s, sizeof(uint32_t));
+}
+
 cc3k_status_t cc3k_recv(cc3k_t *driver, int sd, uint16_t length)
 {
   cc3k_command_recv_t cmd;
   cmd.sd = sd;
   cmd.length = length;
   cmd.flags = 0;
-  return cc3k_send_command(driver, CC3K_COMMAND_RECV, (uint8_t *)&cmd, sizeof(cc3k_command_recv_t)); 
+  return cc3k_send_command_priority(driver, CC3K_PRIORITY_DATA,
+    CC3K_COMMAND_RECV, (uint8_t *)&cmd, sizeof(cc3k_command_recv_t));
 }
 
 cc3k_status_t cc3k_recvfrom(cc3k_t *driver, int sd, uint16_t length)
@@ -665,12 +1703,44 @@ cc3k_status_t cc3k_recvfrom(cc3k_t *driver, int sd, uint16_t length)
   cmd.sd = sd;
   cmd.length = length;
   cmd.flags = 0;
-  return cc3k_send_command(driver, CC3K_COMMAND_RECVFROM, (uint8_t *)&cmd, sizeof(cc3k_command_recv_t)); 
+  return cc3k_send_command_priority(driver, CC3K_PRIORITY_DATA,
+    CC3K_COMMAND_RECVFROM, (uint8_t *)&cmd, sizeof(cc3k_command_recv_t));
+}
+
+cc3k_status_t cc3k_send(cc3k_t *driver, int sd, uint8_t *payload, uint16_t payload_length)
+{
+  cc3k_data_send_t arg;
+  cc3k_status_t status;
+
+  if(payload_length > CC3K_SEND_MAX)
+    return CC3K_INVALID;
+
+  arg.sd = sd;
+  arg.unk = 0x0C;
+  arg.payload_length = payload_length;
+  arg.flags = 0;
+
+  status = cc3k_send_data(driver,
+    CC3K_DATA_SEND,
+    (uint8_t *)&arg,
+    sizeof(cc3k_data_send_t),
+    payload, payload_length,
+    NULL, 0);
+
+  if(status == CC3K_OK)
+    cc3k_socket_tx_event(&driver->socket_manager, sd, payload_length);
+
+  return status;
 }
 
 cc3k_status_t cc3k_sendto(cc3k_t *driver, int sd, uint8_t *payload, uint16_t payload_length, cc3k_sockaddr_t *sa)
 {
   cc3k_data_sendto_t arg;
+  cc3k_status_t status;
+
+  if(payload_length > CC3K_SEND_MAX)
+    return CC3K_INVALID;
+
   arg.sd = sd;
   arg.unk = 0x14;
   arg.payload_length = payload_length;
@@ -678,10 +1748,57 @@ cc3k_status_t cc3k_sendto(cc3k_t *driver, int sd, uint8_t *payload, uint16_t pay
   arg.offset = payload_length + 8;
   arg.unused_length = 0x8;
 
-  return cc3k_send_data(driver,
+  status = cc3k_send_data(driver,
     CC3K_DATA_SENDTO,
     (uint8_t *)&arg,
     sizeof(cc3k_data_sendto_t),
     payload, payload_length,
     (uint8_t *)sa, sizeof(cc3k_sockaddr_t));
+
+  if(status == CC3K_OK)
+    cc3k_socket_tx_event(&driver->socket_manager, sd, payload_length);
+
+  return status;
+}
+
+cc3k_status_t cc3k_ping_send(cc3k_t *driver, uint32_t ip, uint32_t attempts, uint32_t size, uint32_t timeout_ms)
+{
+  cc3k_command_netapp_ping_send_t cmd;
+
+  cmd.ip = ip;
+  cmd.attempts = attempts;
+  cmd.size = size;
+  cmd.timeout = timeout_ms;
+
+  return cc3k_send_command(driver, CC3K_COMMAND_NETAPP_PING_SEND, (uint8_t *)&cmd, sizeof(cc3k_command_netapp_ping_send_t));
+}
+
+cc3k_status_t cc3k_ping_stop(cc3k_t *driver)
+{
+  return cc3k_send_command(driver, CC3K_COMMAND_NETAPP_PING_STOP, NULL, 0);
+}
+
+cc3k_status_t cc3k_gethostbyname(cc3k_t *driver, const char *hostname, uint8_t length)
+{
+  cc3k_command_gethostbyname_t cmd;
+  cc3k_status_t status;
+
+  if(length > CC3K_HOSTNAME_MAX)
+    return CC3K_INVALID;
+
+  if(driver->dns_pending)
+    return CC3K_BUSY;
+
+  cmd.offset = 0x08;
+  cmd.length = length;
+  memcpy(cmd.hostname, hostname, length);
+
+  // Set first, the response can arrive before the send returns
+  driver->dns_pending = 1;
+
+  status = cc3k_send_command(driver, CC3K_COMMAND_GETHOSTBYNAME, (uint8_t *)&cmd, 8 + length);
+  if(status != CC3K_OK)
+    driver->dns_pending = 0;
+
+  return status;
 }
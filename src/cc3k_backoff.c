@@ -0,0 +1,91 @@
+/**
+ * @file CC3K Driver retry backoff
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+
+/**
+ * @brief Get a random number for jitter
+ *
+ * Uses the host random hook when one is configured. Otherwise falls back to
+ * a xorshift generator seeded from the driver timing, which is enough to
+ * break up devices that did not boot at exactly the same millisecond.
+ */
+static uint32_t _random(cc3k_t *driver)
+{
+  uint32_t x;
+
+  if(driver->config->random)
+    return (*driver->config->random)();
+
+  x = driver->random_state;
+  if(x == 0)
+    x = driver->last_time_ms ^ (driver->stats.interrupts << 16) ^ 0x2545F491;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  driver->random_state = x;
+  return x;
+}
+
+void cc3k_backoff_reset(cc3k_backoff_t *backoff)
+{
+  backoff->remaining = 0;
+  backoff->attempts = 0;
+}
+
+uint32_t cc3k_backoff_next(cc3k_t *driver, cc3k_backoff_t *backoff, const cc3k_backoff_config_t *config)
+{
+  uint32_t initial = CC3K_BACKOFF_INITIAL_MS;
+  uint32_t max = CC3K_BACKOFF_MAX_MS;
+  uint8_t jitter = CC3K_BACKOFF_JITTER;
+  uint32_t delay;
+  uint32_t spread;
+  uint16_t i;
+
+  if(config != NULL)
+  {
+    if(config->initial_ms > 0)
+      initial = config->initial_ms;
+    if(config->max_ms > 0)
+      max = config->max_ms;
+    if(config->jitter > 0)
+      jitter = config->jitter > 100 ? 100 : config->jitter;
+  }
+
+  // Double the delay for every previous failure, stopping at the cap
+  delay = initial;
+  for(i=0;i<backoff->attempts && delay < max && delay < 0x80000000;i++)
+    delay <<= 1;
+
+  if(delay > max)
+    delay = max;
+
+  // Randomize the top part of the delay so devices drift apart
+  spread = (delay / 100) * jitter;
+  if(spread > 0)
+    delay -= _random(driver) % (spread + 1);
+
+  if(backoff->attempts < 0xFFFF)
+    backoff->attempts++;
+
+  backoff->remaining = delay;
+  driver->stats.backoff_ms += delay;
+
+  return delay;
+}
+
+int cc3k_backoff_elapsed(cc3k_backoff_t *backoff, uint32_t dt)
+{
+  if(dt >= backoff->remaining)
+  {
+    backoff->remaining = 0;
+    return 1;
+  }
+
+  backoff->remaining -= dt;
+  return 0;
+}
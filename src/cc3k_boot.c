@@ -0,0 +1,166 @@
+/**
+ * @file CC3K Driver bring-up sequence
+ *
+ * After the simple link start response, the driver runs a table of setup
+ * commands. Each step is issued as soon as the response to the previous
+ * one is processed, and the driver is ready once the table is exhausted.
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+#include <string.h>
+
+#ifdef CC3K_DEBUG
+#include <stdio.h>
+#endif
+
+// Set the internal chip debug mask
+// This controls which messages the chip will output
+// on the 1.8v UART pins. These are not accessible on the Spark
+#define CC3K_DEBUG_MASK 0x00000000
+
+static const uint32_t _debug_mask = CC3K_DEBUG_MASK;
+
+static cc3k_status_t _boot_ready(cc3k_t *driver)
+{
+  driver->ready = 1;
+  driver->warm = 0;
+  driver->stats.boot_time_ms = driver->boot_elapsed;
+
+#ifdef CC3K_DEBUG
+  fprintf(stderr, "Ready after %d ms\n", driver->boot_elapsed);
+#endif
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_boot_script_add(cc3k_t *driver, uint16_t opcode, const uint8_t *arg, uint8_t arg_length)
+{
+  cc3k_boot_step_t *step;
+
+  if(driver->boot_steps >= CC3K_BOOT_STEPS_MAX)
+    return CC3K_INVALID;
+
+  step = &driver->boot_script[driver->boot_steps++];
+  step->opcode = opcode;
+  step->arg = arg;
+  step->arg_length = arg_length;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_boot_script_init(cc3k_t *driver)
+{
+  cc3k_config_t *config = driver->config;
+  int i;
+
+  driver->boot_steps = 0;
+  driver->boot_step = 0;
+  driver->ready = 0;
+
+  if(cc3k_boot_script_add(driver, CC3K_COMMAND_NETAPP_SET_DEBUG, (const uint8_t *)&_debug_mask, sizeof(uint32_t)) != CC3K_OK ||
+    cc3k_boot_script_add(driver, CC3K_COMMAND_READ_BUFFER_SIZE, NULL, 0) != CC3K_OK)
+    return CC3K_INVALID;
+
+  // Nothing is read if the cached identity checks out
+  if(cc3k_identity_boot(driver) != CC3K_OK)
+    return CC3K_INVALID;
+
+  if(config->event_mask != 0)
+  {
+    driver->event_mask = cc3k_event_mask_filter(driver, config->event_mask);
+    if(cc3k_boot_script_add(driver, CC3K_COMMAND_SET_EVENT_MASK, (const uint8_t *)&driver->event_mask, sizeof(uint32_t)) != CC3K_OK)
+      return CC3K_INVALID;
+  }
+
+  // Stored on the chip only once it reports another address, to spare
+  // its NVMEM a write on every boot
+  if(config->static_ip != NULL)
+  {
+    driver->static_ip = *config->static_ip;
+    driver->static_ip_enabled = 1;
+  }
+
+  if(config->timers != NULL)
+  {
+    cc3k_netapp_timers_args(&driver->netapp_timers, config->timers);
+    if(cc3k_boot_script_add(driver, CC3K_COMMAND_NETAPP_SET_TIMERS, (const uint8_t *)&driver->netapp_timers, sizeof(cc3k_command_netapp_set_timers_t)) != CC3K_OK)
+      return CC3K_INVALID;
+  }
+
+  // Application supplied steps run last
+  for(i=0;i<config->boot_script_length;i++)
+  {
+    if(cc3k_boot_script_add(driver, config->boot_script[i].opcode,
+      config->boot_script[i].arg, config->boot_script[i].arg_length) != CC3K_OK)
+      return CC3K_INVALID;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_boot_script_warm(cc3k_t *driver)
+{
+  cc3k_config_t *config = driver->config;
+
+  driver->boot_steps = 0;
+  driver->boot_step = 0;
+  driver->ready = 0;
+
+  // The answer shows the chip is still running, and whether it kept the AP
+  if(cc3k_boot_script_add(driver, CC3K_COMMAND_IOCTL_STATUSGET, NULL, 0) != CC3K_OK)
+    return CC3K_INVALID;
+
+  if(cc3k_identity_boot(driver) != CC3K_OK)
+    return CC3K_INVALID;
+
+  // Already applied on the chip, only the driver's copy is needed
+  if(config->static_ip != NULL)
+  {
+    driver->static_ip = *config->static_ip;
+    driver->static_ip_enabled = 1;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_boot_script_run(cc3k_t *driver)
+{
+  cc3k_boot_step_t *step;
+
+  if(driver->ready)
+    return CC3K_OK;
+
+  if(driver->boot_step >= driver->boot_steps)
+    return _boot_ready(driver);
+
+  step = &driver->boot_script[driver->boot_step];
+
+  // cc3k_send_command refuses if another command is still outstanding,
+  // in which case the main loop will try again
+  return cc3k_send_command(driver, step->opcode, (uint8_t *)step->arg, step->arg_length);
+}
+
+cc3k_status_t cc3k_boot_script_response(cc3k_t *driver, uint16_t opcode)
+{
+  if(driver->ready)
+    return CC3K_OK;
+
+  if(opcode == CC3K_COMMAND_SIMPLE_LINK_START)
+  {
+    // The chip is running, start at the top of the table
+    driver->boot_step = 0;
+  }
+  else if(driver->boot_step < driver->boot_steps &&
+    opcode == driver->boot_script[driver->boot_step].opcode)
+  {
+    driver->boot_step++;
+  }
+  else
+  {
+    // Not a response to a boot step
+    return CC3K_OK;
+  }
+
+  return cc3k_boot_script_run(driver);
+}
@@ -3,6 +3,31 @@
 
 #include "../ap.h"
 
+/**
+ * @brief Return the chip buffers released by sent data frames
+ */
+static void _free_buffer_event(cc3k_t *driver, cc3k_free_buffer_event_t *ev, uint8_t arg_length)
+{
+  cc3k_free_buffer_entry_t *entry;
+  uint32_t released = 0;
+  uint16_t i;
+
+  entry = (cc3k_free_buffer_entry_t *)(ev + 1);
+
+  for(i=0;i<ev->num_handles;i++)
+  {
+    // Ignore entries past the end of the event
+    if((uint8_t *)(entry + 1) > (uint8_t *)ev + arg_length)
+      break;
+
+    released += entry->free;
+    entry++;
+  }
+
+  released += driver->buffers_free;
+  driver->buffers_free = released > driver->buffers ? driver->buffers : released;
+}
+
 cc3k_status_t cc3k_process_event(cc3k_t *driver, uint16_t opcode, uint8_t *arg, uint8_t arg_length)
 {
   cc3k_buffer_size_t *buffer_info;
@@ -10,34 +35,77 @@ cc3k_status_t cc3k_process_event(cc3k_t *driver, uint16_t opcode, uint8_t *arg,
   cc3k_socket_event_t *socket_event;
   cc3k_recv_event_t *recv_event;
   cc3k_select_event_t *select_event;
+  cc3k_getsockopt_event_t *sockopt_event;
+  cc3k_gethostbyname_event_t *dns_event;
 
   switch(opcode)
   {
     case CC3K_COMMAND_READ_BUFFER_SIZE:
       buffer_info = (cc3k_buffer_size_t *)arg;
       driver->buffers = buffer_info->count;
+      driver->buffers_free = buffer_info->count;
+      driver->buffer_size = buffer_info->size;
+      break;
+
+    case CC3K_COMMAND_READ_SP_VERSION:
+      cc3k_identity_version_event(driver, arg, arg_length);
+      break;
+
+    case CC3K_EVENT_FREE_BUFFER:
+      _free_buffer_event(driver, (cc3k_free_buffer_event_t *)arg, arg_length);
+
+      // A stream may have been waiting for a buffer
+      cc3k_socket_tx_done(&driver->socket_manager);
       break;
 
     case CC3K_COMMAND_IOCTL_STATUSGET:
       status_event = (cc3k_status_event_t *)arg;
       driver->wlan_status = status_event->wlan_status;
+      // The address from before a warm start only holds while associated
+      if(driver->wlan_status != WLAN_STATUS_CONNECTED)
+        driver->dhcp_complete = 0;
       break;
 
     case CC3K_EVENT_WLAN_DHCP:
       memcpy(&driver->ipconfig, arg+1, sizeof(cc3k_ipconfig_t));
       driver->dhcp_complete=1;
+
+      // The chip applies a static address from its next power up, so
+      // only its own report shows whether the address is in effect
+      if(driver->static_ip_enabled)
+      {
+        driver->static_ip_active = cc3k_static_ip_match(driver);
+        driver->static_ip_write = !driver->static_ip_active;
+      }
       break;
 
     case CC3K_EVENT_WLAN_CONNECT:
       driver->wlan_status = WLAN_STATUS_CONNECTED;
+      cc3k_backoff_reset(&driver->wlan_backoff);
+
+      // With a static address in effect there is no DHCP exchange to wait for
+      if(driver->static_ip_enabled && driver->static_ip_active)
+      {
+        driver->ipconfig = driver->static_ip;
+        driver->dhcp_complete = 1;
+      }
       // Link layer is up
       cc3k_link_event(&driver->socket_manager, CC3K_LINK_UP);
       break;
     
     case CC3K_EVENT_WLAN_DISCONNECT:
       driver->wlan_status = WLAN_STATUS_DISCONNECTED;
+      // Jitter the first reconnect so devices sharing an AP do not
+      // all retry at once. A failed attempt has already armed the timer.
+      if(driver->wlan_backoff.remaining == 0)
+        cc3k_backoff_next(driver, &driver->wlan_backoff, &driver->config->wlan_backoff);
       // Inform the socket manager that the link layer is down
       cc3k_link_event(&driver->socket_manager, CC3K_LINK_DOWN);
+      cc3k_ping_reset(driver);
+      break;
+
+    case CC3K_EVENT_PING_REPORT:
+      cc3k_ping_report_event(driver, arg, arg_length);
       break;
 
     case CC3K_COMMAND_SOCKET:
@@ -56,6 +124,10 @@ cc3k_status_t cc3k_process_event(cc3k_t *driver, uint16_t opcode, uint8_t *arg,
       socket_event = (cc3k_socket_event_t *)arg;
       cc3k_connect_event(&driver->socket_manager, socket_event->result);
       break;
+    case CC3K_COMMAND_GETMSS:
+      socket_event = (cc3k_socket_event_t *)arg;
+      cc3k_mss_event(&driver->socket_manager, socket_event->result);
+      break;
     case CC3K_COMMAND_LISTEN:
       socket_event = (cc3k_socket_event_t *)arg;
       break;
@@ -69,8 +141,27 @@ cc3k_status_t cc3k_process_event(cc3k_t *driver, uint16_t opcode, uint8_t *arg,
       break;
 
     case CC3K_COMMAND_RECV:
+    case CC3K_COMMAND_RECVFROM:
       recv_event = (cc3k_recv_event_t *)arg;
-      //cc3k_recv_event(&driver->socket_manager, recv_event->sd, recv_event->length); 
+      cc3k_recv_event(&driver->socket_manager, recv_event->sd, recv_event->length); 
+      break;
+
+    case CC3K_COMMAND_SETSOCKOPT:
+      socket_event = (cc3k_socket_event_t *)arg;
+      cc3k_sockopt_event(&driver->socket_manager, socket_event->result);
+      break;
+    case CC3K_COMMAND_GETSOCKOPT:
+      sockopt_event = (cc3k_getsockopt_event_t *)arg;
+      driver->sockopt_status = sockopt_event->status;
+      driver->sockopt_value = sockopt_event->value;
+      driver->sockopt_pending = 0;
+      break;
+
+    case CC3K_COMMAND_GETHOSTBYNAME:
+      dns_event = (cc3k_gethostbyname_event_t *)arg;
+      driver->dns_result = dns_event->result;
+      driver->dns_ip = dns_event->ip;
+      driver->dns_pending = 0;
       break;
 
     case CC3K_EVENT_TCP_CLOSE_WAIT:
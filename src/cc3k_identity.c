@@ -0,0 +1,133 @@
+/**
+ * @file CC3K Driver chip identity
+ *
+ * The MAC address and service pack version never change for a given
+ * module, so they are read once and kept in a blob the application
+ * stores. A blob that passes its checksum on the next boot saves the
+ * reads, and the identity is known before the chip is even up.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <cc3k.h>
+#include <string.h>
+
+#ifdef CC3K_DEBUG
+#include <stdio.h>
+#endif
+
+/**
+ * @brief Hash every field before the checksum
+ */
+static uint32_t _checksum(const cc3k_identity_t *identity)
+{
+  return cc3k_checksum(identity, offsetof(cc3k_identity_t, checksum));
+}
+
+int cc3k_identity_valid(const cc3k_identity_t *identity)
+{
+  return identity->magic == CC3K_IDENTITY_MAGIC && identity->checksum == _checksum(identity);
+}
+
+/**
+ * @brief Seal the identity once every part has been read, and hand it to the application
+ */
+static void _identity_update(cc3k_t *driver)
+{
+  cc3k_config_t *config = driver->config;
+
+  if(driver->identity_pending)
+    return;
+
+  driver->identity.magic = CC3K_IDENTITY_MAGIC;
+  driver->identity.checksum = _checksum(&driver->identity);
+
+#ifdef CC3K_DEBUG
+  fprintf(stderr, "Identity %02X:%02X:%02X:%02X:%02X:%02X version %d.%d\n",
+    driver->identity.mac[0], driver->identity.mac[1], driver->identity.mac[2],
+    driver->identity.mac[3], driver->identity.mac[4], driver->identity.mac[5],
+    driver->identity.sp_version[0], driver->identity.sp_version[1]);
+#endif
+
+  *config->identity = driver->identity;
+
+  if(config->identity_save)
+    (*config->identity_save)(driver, config->identity);
+}
+
+cc3k_status_t cc3k_identity_boot(cc3k_t *driver)
+{
+  cc3k_config_t *config = driver->config;
+
+  driver->identity_pending = 0;
+
+  if(config->identity == NULL)
+    return CC3K_OK;
+
+  if(cc3k_identity_valid(config->identity))
+  {
+    driver->identity = *config->identity;
+    return CC3K_OK;
+  }
+
+  bzero(&driver->identity, sizeof(cc3k_identity_t));
+  driver->identity_pending = CC3K_IDENTITY_MAC | CC3K_IDENTITY_VERSION;
+
+  driver->nvmem_read.file_id = CC3K_NVMEM_MAC_FILEID;
+  driver->nvmem_read.length = CC3K_MAC_LENGTH;
+  driver->nvmem_read.offset = 0;
+
+  if(cc3k_boot_script_add(driver, CC3K_COMMAND_NVMEM_READ, (const uint8_t *)&driver->nvmem_read, sizeof(cc3k_command_nvmem_read_t)) != CC3K_OK ||
+    cc3k_boot_script_add(driver, CC3K_COMMAND_READ_SP_VERSION, NULL, 0) != CC3K_OK)
+  {
+    driver->identity_pending = 0;
+    return CC3K_INVALID;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_identity_version_event(cc3k_t *driver, const uint8_t *arg, uint8_t arg_length)
+{
+  // Status byte, then a 32 bit version whose top two bytes are
+  // the package ID and build number
+  if(arg_length < 5 || arg[0] != 0)
+    return CC3K_INVALID;
+
+  driver->identity.sp_version[0] = arg[3];
+  driver->identity.sp_version[1] = arg[4];
+
+  if(driver->identity_pending & CC3K_IDENTITY_VERSION)
+  {
+    driver->identity_pending &= ~CC3K_IDENTITY_VERSION;
+    _identity_update(driver);
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_identity_nvmem_event(cc3k_t *driver, const uint8_t *data, uint16_t length)
+{
+  // Only the MAC address read is ours
+  if(!(driver->identity_pending & CC3K_IDENTITY_MAC) || length < CC3K_MAC_LENGTH)
+    return CC3K_INVALID;
+
+  memcpy(driver->identity.mac, data, CC3K_MAC_LENGTH);
+
+  driver->identity_pending &= ~CC3K_IDENTITY_MAC;
+  _identity_update(driver);
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_get_identity(cc3k_t *driver, cc3k_identity_t *identity)
+{
+  if(driver->config->identity == NULL)
+    return CC3K_INVALID;
+
+  if(driver->identity_pending || driver->identity.magic != CC3K_IDENTITY_MAGIC)
+    return CC3K_BUSY;
+
+  *identity = driver->identity;
+  return CC3K_OK;
+}
@@ -46,6 +46,11 @@ cc3k_status_t cc3k_data(cc3k_t *driver, uint8_t opcode, uint8_t *arg, uint8_t ar
   uint8_t *payload, uint16_t payload_length, uint8_t *footer, uint8_t footer_length)
 {
   cc3k_data_header_t *data_header;
+
+  // Refuse frames that would overrun the transmit buffer, padding included
+  if(sizeof(cc3k_spi_header_t) + sizeof(cc3k_data_header_t) + arg_length + payload_length + footer_length + 1 > (CC3K_BUFFER_SIZE))
+    return CC3K_INVALID;
+
   bzero(driver->packet_tx_buffer, CC3K_BUFFER_SIZE);
   bzero(driver->packet_rx_buffer, CC3K_BUFFER_SIZE);
 
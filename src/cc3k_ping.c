@@ -0,0 +1,163 @@
+/**
+ * @file CC3K Driver link monitor
+ *
+ * Pings the default gateway at a fixed interval and keeps round trip and
+ * loss statistics, so the application can roam or reconnect when the
+ * link degrades instead of waiting for its sockets to time out.
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+#include <string.h>
+
+#ifdef CC3K_DEBUG
+#include <stdio.h>
+#endif
+
+static uint32_t _attempts(const cc3k_ping_config_t *config)
+{
+  return config->attempts ? config->attempts : CC3K_PING_ATTEMPTS;
+}
+
+static uint32_t _timeout(const cc3k_ping_config_t *config)
+{
+  return config->timeout_ms ? config->timeout_ms : CC3K_PING_TIMEOUT_MS;
+}
+
+/**
+ * @brief Check a round against the degradation thresholds
+ */
+static int _bad_round(const cc3k_ping_config_t *config, const cc3k_ping_report_t *report)
+{
+  uint32_t lost;
+
+  if(report->sent == 0)
+    return 0;
+
+  lost = report->sent > report->received ? report->sent - report->received : 0;
+  if(lost * 100 > (uint32_t)config->loss_threshold * report->sent)
+    return 1;
+
+  if(config->rtt_threshold_ms && report->received > 0 && report->rtt_avg > config->rtt_threshold_ms)
+    return 1;
+
+  return 0;
+}
+
+/**
+ * @brief Fold a finished round into the statistics
+ */
+static void _round_done(cc3k_t *driver, const cc3k_ping_report_t *report)
+{
+  const cc3k_ping_config_t *config = &driver->config->ping;
+  cc3k_ping_t *ping = &driver->ping;
+  uint8_t rounds;
+
+  ping->pending = 0;
+  ping->last = *report;
+  ping->rounds++;
+  ping->sent += report->sent;
+  ping->received += report->received;
+
+  if(report->received > 0)
+  {
+    // Smooth the average with a weight of 1/8, like TCP's SRTT
+    if(ping->rtt_smoothed == 0)
+      ping->rtt_smoothed = report->rtt_avg;
+    else
+      ping->rtt_smoothed = (ping->rtt_smoothed * 7 + report->rtt_avg) / 8;
+
+    if(ping->rtt_min == 0 || report->rtt_min < ping->rtt_min)
+      ping->rtt_min = report->rtt_min;
+    if(report->rtt_max > ping->rtt_max)
+      ping->rtt_max = report->rtt_max;
+  }
+
+  rounds = config->degraded_rounds ? config->degraded_rounds : CC3K_PING_DEGRADED_ROUNDS;
+
+  if(_bad_round(config, report))
+  {
+    if(ping->bad_rounds < rounds)
+      ping->bad_rounds++;
+    if(ping->bad_rounds >= rounds)
+      ping->degraded = 1;
+  }
+  else
+  {
+    ping->bad_rounds = 0;
+    ping->degraded = 0;
+  }
+
+#ifdef CC3K_DEBUG
+  fprintf(stderr, "Ping %u/%u rtt %u/%u/%u degraded %d\n", report->received, report->sent,
+    report->rtt_min, report->rtt_avg, report->rtt_max, ping->degraded);
+#endif
+
+  if(config->callback)
+    (*config->callback)(driver, report, ping->degraded);
+}
+
+void cc3k_ping_update(cc3k_t *driver, uint32_t dt)
+{
+  const cc3k_ping_config_t *config = &driver->config->ping;
+  cc3k_ping_t *ping = &driver->ping;
+  cc3k_ping_report_t lost;
+
+  if(config->interval_ms == 0)
+    return;
+
+  ping->elapsed += dt;
+
+  if(ping->pending)
+  {
+    // The chip answers once every attempt has had its timeout. If the
+    // report has still not arrived an interval later, count the round as lost.
+    if(ping->elapsed < _attempts(config) * _timeout(config) + config->interval_ms)
+      return;
+
+    bzero(&lost, sizeof(cc3k_ping_report_t));
+    lost.sent = _attempts(config);
+    ping->lost_reports++;
+    _round_done(driver, &lost);
+  }
+
+  if(ping->elapsed < config->interval_ms)
+    return;
+
+  // Nothing to ping until DHCP has named a gateway
+  if(driver->ipconfig.default_gateway == 0)
+    return;
+
+  if(cc3k_ping_send(driver, driver->ipconfig.default_gateway, _attempts(config),
+    config->size ? config->size : CC3K_PING_SIZE, _timeout(config)) == CC3K_OK)
+  {
+    ping->pending = 1;
+    ping->elapsed = 0;
+  }
+}
+
+cc3k_status_t cc3k_ping_report_event(cc3k_t *driver, const uint8_t *arg, uint8_t arg_length)
+{
+  const cc3k_ping_report_event_t *ev = (const cc3k_ping_report_event_t *)arg;
+  cc3k_ping_report_t report;
+
+  if(arg_length < sizeof(cc3k_ping_report_event_t))
+    return CC3K_INVALID;
+
+  report.sent = ev->sent;
+  report.received = ev->received;
+  report.rtt_min = ev->rtt_min;
+  report.rtt_max = ev->rtt_max;
+  report.rtt_avg = ev->rtt_avg;
+
+  // Rounds started by the application are reported the same way
+  _round_done(driver, &report);
+
+  return CC3K_OK;
+}
+
+void cc3k_ping_reset(cc3k_t *driver)
+{
+  driver->ping.pending = 0;
+  driver->ping.elapsed = 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file CC3K Driver packet buffer pool
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+#include <string.h>
+
+int cc3k_pool_index(cc3k_pool_t *pool, const uint8_t *p)
+{
+  uint32_t offset;
+
+  if(p < pool->storage)
+    return -1;
+
+  offset = p - pool->storage;
+  if(offset >= (uint32_t)pool->block_size * pool->count)
+    return -1;
+
+  return offset / pool->block_size;
+}
+
+cc3k_status_t cc3k_pool_init(cc3k_pool_t *pool, uint8_t *storage, uint16_t block_size, uint8_t count)
+{
+  if(storage == NULL || block_size == 0 || count == 0 || count > CC3K_POOL_BLOCKS_MAX)
+    return CC3K_INVALID;
+
+  bzero(pool, sizeof(cc3k_pool_t));
+
+  pool->storage = storage;
+  pool->block_size = block_size;
+  pool->count = count;
+  pool->free = count == 32 ? 0xFFFFFFFF : ((uint32_t)1 << count) - 1;
+
+  return CC3K_OK;
+}
+
+uint8_t *cc3k_pool_alloc(cc3k_pool_t *pool)
+{
+  uint32_t free;
+  uint8_t in_use;
+  uint8_t high_water;
+  int i;
+
+  free = pool->free;
+  do
+  {
+    if(free == 0)
+    {
+      __atomic_fetch_add(&pool->failures, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+
+    i = __builtin_ctz(free);
+  }
+  // On failure free is reloaded with the current bitmap
+  while(!__atomic_compare_exchange_n(&pool->free, &free, free & ~((uint32_t)1 << i),
+    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  in_use = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pool->allocs, 1, __ATOMIC_RELAXED);
+
+  // A writer preempted between the test and the store must not put back
+  // a smaller value, so the mark only moves up by compare and swap
+  high_water = pool->high_water;
+  while(in_use > high_water &&
+    !__atomic_compare_exchange_n(&pool->high_water, &high_water, in_use,
+      0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  return pool->storage + (uint32_t)i * pool->block_size;
+}
+
+cc3k_status_t cc3k_pool_free(cc3k_pool_t *pool, uint8_t *block)
+{
+  uint32_t bit;
+  int i;
+
+  i = cc3k_pool_index(pool, block);
+  if(i < 0)
+    return CC3K_INVALID;
+
+  bit = (uint32_t)1 << i;
+
+  // Refuse a double free rather than corrupting the count
+  if(__atomic_fetch_or(&pool->free, bit, __ATOMIC_RELEASE) & bit)
+    return CC3K_INVALID_STATE;
+
+  __atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+
+  return CC3K_OK;
+}
+
+uint8_t cc3k_pool_available(cc3k_pool_t *pool)
+{
+  return __builtin_popcount(pool->free);
+}
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <cc3k.h>
 #include <socket.h>
+#include <cc3k_data.h>
 #include <string.h>
 
 #ifdef CC3K_DEBUG
@@ -23,6 +24,68 @@ static cc3k_status_t _find_socket(cc3k_socket_manager_t *socket_manager, int32_t
   return CC3K_OK;
 }
 
+/**
+ * @brief Return a socket's slot to the free list
+ *
+ * Called from the main loop, and from cc3k_socket_remove in the caller's
+ * context. Neither may run in an interrupt, so the free list needs no
+ * locking against the interrupt handler.
+ */
+static void _release(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  socket_manager->socket[socket->slot] = NULL;
+  socket_manager->free_slots[socket_manager->num_free++] = socket->slot;
+  socket_manager->num_sockets--;
+
+  if(socket_manager->current == socket)
+    socket_manager->current = NULL;
+
+  socket->state = SOCKET_STATE_CLOSED;
+  socket->remove = 0;
+  socket->registered = 0;
+}
+
+/**
+ * @brief Move a socket being removed towards release
+ *
+ * @return 1 if the socket was released
+ */
+static int _remove_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  switch(socket->state)
+  {
+    case SOCKET_STATE_INIT:
+    case SOCKET_STATE_FAILED:
+    case SOCKET_STATE_CLOSED:
+      // Nothing open on the chip
+      _release(socket_manager, socket);
+      return 1;
+    case SOCKET_STATE_CREATED:
+    case SOCKET_STATE_BOUND:
+    case SOCKET_STATE_READY:
+      socket->state = SOCKET_STATE_CLOSE_WAIT;
+      break;
+    default:
+      // Wait for the command in flight to finish
+      break;
+  }
+
+  return 0;
+}
+
+static void _notify(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, uint8_t events)
+{
+  events &= socket->ready_mask;
+
+  // A socket stays writable, so interest in it lasts for one report or
+  // every select would return straight away
+  if(events & CC3K_SOCKET_WRITABLE)
+    socket->ready_mask &= ~CC3K_SOCKET_WRITABLE;
+
+  if(events != 0 && socket->ready_callback)
+    (*socket->ready_callback)(socket_manager->driver, socket, events);
+}
+
 /**
  * These are called from the event processor when a socket event is received
  * The current socket index associated with this event is stored in the socket manager
@@ -38,8 +101,12 @@ cc3k_status_t cc3k_link_event(cc3k_socket_manager_t *socket_manager, cc3k_link_s
       // Destroy all of the sockets
       for(i=0;i<CC3K_MAX_SOCKETS;i++)
       {
-        if(socket_manager->socket[i] != NULL)
+        if(socket_manager->socket[i] != NULL &&
+           socket_manager->socket[i]->state != SOCKET_STATE_INIT &&
+           socket_manager->socket[i]->state != SOCKET_STATE_CLOSED)
         {
+          if(socket_manager->socket[i]->state == SOCKET_STATE_READY)
+            _notify(socket_manager, socket_manager->socket[i], CC3K_SOCKET_CLOSED);
           socket_manager->socket[i]->state = SOCKET_STATE_CLOSE_WAIT;
         }
       }
@@ -55,8 +122,21 @@ cc3k_status_t cc3k_link_event(cc3k_socket_manager_t *socket_manager, cc3k_link_s
 
 cc3k_status_t cc3k_socket_event(cc3k_socket_manager_t *socket_manager, uint32_t sd)
 {
+  // The watchdog gave up on this command, so the descriptor the chip
+  // handed out after all belongs to no socket and is closed
+  if(socket_manager->current == NULL || socket_manager->current->state != SOCKET_STATE_CREATE)
+  {
+    if((int32_t)sd >= 0 && sd < 32)
+      socket_manager->stale |= (1<<sd);
+    return CC3K_OK;
+  }
+
   socket_manager->current->sd = sd;
   socket_manager->current->state = SOCKET_STATE_CREATED;
+  socket_manager->current->mss = 0;
+  socket_manager->current->mss_requested = 0;
+  // A new descriptor starts with the chip defaults
+  socket_manager->current->options_pending = socket_manager->current->options_set;
 #ifdef CC3K_DEBUG
   fprintf(stderr, "Socket %d created\n", sd);
 #endif
@@ -65,23 +145,33 @@ cc3k_status_t cc3k_socket_event(cc3k_socket_manager_t *socket_manager, uint32_t
 
 cc3k_status_t cc3k_connect_event(cc3k_socket_manager_t *socket_manager, uint32_t result)
 {
+  // A late answer to a connect the watchdog gave up on, the socket has
+  // already been sent to close
+  if(socket_manager->current == NULL || socket_manager->current->state != SOCKET_STATE_CONNECTING)
+    return CC3K_OK;
+
   if(result == 0)
   {
     // Successfully connected
     socket_manager->current->state = SOCKET_STATE_READY;
+    cc3k_backoff_reset(&socket_manager->current->backoff);
 #ifdef CC3K_DEBUG
     fprintf(stderr, "Socket %d connected\n", socket_manager->current->sd);
 #endif
+    _notify(socket_manager, socket_manager->current, CC3K_SOCKET_CONNECTED);
   }
   else
   {
-    // Connection failed
-    // TODO: Configurable retry timeout
-    socket_manager->current->retry_timeout = 1000;
-    socket_manager->current->state = SOCKET_STATE_FAILED;
+    // Connection failed. Release the descriptor on the chip, and retry
+    // from scratch once the backoff delay has passed.
+    if(!socket_manager->current->oneshot)
+      cc3k_backoff_next(socket_manager->driver, &socket_manager->current->backoff,
+        &socket_manager->driver->config->socket_backoff);
+    socket_manager->current->state = SOCKET_STATE_CLOSE_WAIT;
 #ifdef CC3K_DEBUG
     fprintf(stderr, "Socket %d connection failed\n", socket_manager->current->sd);
 #endif
+    _notify(socket_manager, socket_manager->current, CC3K_SOCKET_CLOSED);
   }    
 
   return CC3K_OK;
@@ -100,6 +190,9 @@ cc3k_status_t cc3k_tcp_close_wait_event(cc3k_socket_manager_t *socket_manager, c
   if(socket == NULL)
     return CC3K_INVALID;
 
+  if(socket->state == SOCKET_STATE_READY)
+    _notify(socket_manager, socket, CC3K_SOCKET_CLOSED);
+
   socket->state = SOCKET_STATE_CLOSE_WAIT;
   
   return CC3K_OK;
@@ -110,22 +203,318 @@ cc3k_status_t cc3k_close_event(cc3k_socket_manager_t *socket_manager, uint32_t r
 #ifdef CC3K_DEBUG
   fprintf(stderr, "Socket closed %d\n", result);
 #endif
-  socket_manager->current->state = SOCKET_STATE_INIT;
+  // A stale descriptor has no socket behind it
+  if(socket_manager->current == NULL)
+    return CC3K_OK;
+
+  // A socket closed after a failed connect waits out its backoff first
+  if(socket_manager->current->oneshot || socket_manager->current->remove)
+    socket_manager->current->state = SOCKET_STATE_CLOSED;
+  else if(socket_manager->current->backoff.remaining > 0)
+    socket_manager->current->state = SOCKET_STATE_FAILED;
+  else
+    socket_manager->current->state = SOCKET_STATE_INIT;
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_mss_event(cc3k_socket_manager_t *socket_manager, int32_t result)
+{
+  if(socket_manager->current == NULL)
+    return CC3K_INVALID;
+
+  // Fall back to the largest send if the chip has no sensible answer
+  if(result <= 0 || result > CC3K_SEND_MAX)
+    result = CC3K_SEND_MAX;
+
+  socket_manager->current->mss = result;
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_sockopt_event(cc3k_socket_manager_t *socket_manager, int32_t result)
+{
+  cc3k_socket_t *socket = socket_manager->current;
+
+  if(socket == NULL)
+    return CC3K_INVALID;
+
+  // A failed option is not retried, the result is kept for the application
+  socket->options_pending &= ~(1 << socket->option_applying);
+  socket->option_result = result;
   return CC3K_OK;
 }
 
 cc3k_status_t cc3k_bind_event(cc3k_socket_manager_t *socket_manager, uint32_t result)
 {
+  // A late answer to a bind the watchdog gave up on
+  if(socket_manager->current == NULL || socket_manager->current->state != SOCKET_STATE_BINDING)
+    return CC3K_OK;
+
   if(socket_manager->current->type == SOCK_STREAM)
+  {
     socket_manager->current->state = SOCKET_STATE_BOUND;
+  }
   else
+  {
     socket_manager->current->state = SOCKET_STATE_READY;
+    _notify(socket_manager, socket_manager->current, CC3K_SOCKET_CONNECTED);
+  }
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_abort(cc3k_socket_manager_t *socket_manager)
+{
+  cc3k_socket_t *socket = socket_manager->current;
+
+  socket_manager->current = NULL;
+  socket_manager->select_pending = 0;
+
+  if(socket == NULL)
+    return CC3K_OK;
+
+  switch(socket->state)
+  {
+    case SOCKET_STATE_CREATE:
+      // No descriptor was handed out
+      socket->state = SOCKET_STATE_INIT;
+      break;
+    case SOCKET_STATE_CONNECTING:
+      // Treat it as a failed connection
+      if(!socket->oneshot)
+        cc3k_backoff_next(socket_manager->driver, &socket->backoff,
+          &socket_manager->driver->config->socket_backoff);
+      socket->state = SOCKET_STATE_CLOSE_WAIT;
+      _notify(socket_manager, socket, CC3K_SOCKET_CLOSED);
+      break;
+    case SOCKET_STATE_BINDING:
+    case SOCKET_STATE_LISTENING:
+    case SOCKET_STATE_ACCEPTING:
+      socket->state = SOCKET_STATE_CLOSE_WAIT;
+      break;
+    case SOCKET_STATE_CLOSING:
+      // Assume the descriptor is gone
+      socket_manager->current = socket;
+      cc3k_close_event(socket_manager, 0);
+      socket_manager->current = NULL;
+      break;
+    case SOCKET_STATE_READY:
+      // Lost a receive, ask for the data again
+      socket->readable = 1;
+      break;
+    default:
+      break;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_manager_reset(cc3k_socket_manager_t *socket_manager)
+{
+  cc3k_socket_t *socket;
+  int i;
+
+  socket_manager->current = NULL;
+  socket_manager->select_pending = 0;
+  socket_manager->stale = 0;
+
+  // Every descriptor on the chip is gone, so there is nothing left to close
+  for(i=0;i<CC3K_MAX_SOCKETS;i++)
+  {
+    socket = socket_manager->socket[i];
+    if(socket == NULL || socket->state == SOCKET_STATE_CLOSED)
+      continue;
+
+    if(socket->state == SOCKET_STATE_READY)
+      _notify(socket_manager, socket, CC3K_SOCKET_CLOSED);
+
+    if(socket->oneshot || socket->remove)
+      socket->state = SOCKET_STATE_CLOSED;
+    else
+      socket->state = SOCKET_STATE_INIT;
+
+    socket->readable = 0;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_manager_offline(cc3k_socket_manager_t *socket_manager)
+{
+  cc3k_socket_t *socket;
+  int i;
+
+  for(i=0;i<CC3K_MAX_SOCKETS;i++)
+  {
+    socket = socket_manager->socket[i];
+
+    if(socket == NULL || !socket->remove)
+      continue;
+
+    // A socket with a command in flight waits for its answer
+    if(socket == socket_manager->current && socket_manager->driver->command != 0)
+      continue;
+
+    _release(socket_manager, socket);
+  }
+
   return CC3K_OK;
 }
 
+static void _batch_done(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, cc3k_batch_t *batch, cc3k_status_t status)
+{
+  batch->active = 0;
+
+  if(batch == &socket->tx_batch && socket_manager->streaming == socket)
+    socket_manager->streaming = NULL;
+
+  if(batch->done)
+    (*batch->done)(socket_manager->driver, socket, status, batch->index);
+}
+
+/**
+ * @brief Check whether an option is in effect on the chip
+ */
+static int _option(cc3k_socket_t *socket, uint32_t optname)
+{
+  uint8_t bit = 1 << optname;
+  return (socket->options_set & bit) && !(socket->options_pending & bit);
+}
+
+static int _nonblocking(cc3k_socket_t *socket)
+{
+  return _option(socket, SOCKOPT_RECV_NONBLOCK) && socket->options[SOCKOPT_RECV_NONBLOCK] == SOCK_ON;
+}
+
+/**
+ * @brief Receive timeout of a socket that is read without select
+ *
+ * @return The timeout, or zero if the socket is read after a select
+ */
+static uint32_t _recv_timeout(cc3k_socket_t *socket)
+{
+  if(_nonblocking(socket) || !_option(socket, SOCKOPT_RECV_TIMEOUT))
+    return 0;
+
+  return socket->options[SOCKOPT_RECV_TIMEOUT];
+}
+
+/**
+ * @brief Send the next option still waiting for the chip
+ *
+ * @return 1 if the command was issued
+ */
+static int _socket_setopt(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  uint8_t optname;
+
+  for(optname=0;optname<CC3K_SOCKOPT_COUNT;optname++)
+  {
+    if(socket->options_pending & (1 << optname))
+      break;
+  }
+
+  if(optname == CC3K_SOCKOPT_COUNT)
+    return 0;
+
+  if(cc3k_setsockopt(socket_manager->driver, socket->sd, SOL_SOCKET, optname,
+    (const uint8_t *)&socket->options[optname], sizeof(uint32_t)) != CC3K_OK)
+    return 0;
+
+  socket_manager->current = socket;
+  socket->option_applying = optname;
+  return 1;
+}
+
+/**
+ * @brief Ask the chip for the data waiting on a readable socket
+ *
+ * @return 1 if the receive command was issued
+ */
+static int _socket_recv(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  cc3k_status_t status = CC3K_INVALID;
+  uint16_t length;
+
+  // Hold off while the application has no room for the data
+  length = CC3K_RECV_LENGTH;
+  if(socket->receive_window)
+  {
+    length = (*socket->receive_window)(socket_manager->driver, socket);
+    if(length > CC3K_RECV_LENGTH)
+      length = CC3K_RECV_LENGTH;
+    if(length == 0)
+      return 0;
+  }
+
+  // Never read more than the batch entry can hold
+  if(socket->rx_batch.active && socket->rx_batch.vec[socket->rx_batch.index].length < length)
+    length = socket->rx_batch.vec[socket->rx_batch.index].length;
+
+  if(socket->type == SOCK_STREAM)
+    status = cc3k_recv(socket_manager->driver, socket->sd, length);
+  else if(socket->type == SOCK_DGRAM)
+    status = cc3k_recvfrom(socket_manager->driver, socket->sd, length);
+
+  if(status != CC3K_OK)
+    return 0;
+
+  socket->readable = 0;
+  socket->recv_length = length;
+  socket_manager->recv_timeout_ms = _recv_timeout(socket);
+  return 1;
+}
+
+/**
+ * @brief Keep reading a socket that filled the last receive
+ *
+ * A full read means more data is probably waiting, so it is fetched
+ * without another select, up to the drain budget. The rest is left for
+ * the next loop pass so other sockets get a turn. Only sockets whose
+ * receive cannot block the chip indefinitely are drained.
+ */
+static void _socket_drain(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, uint32_t data_length)
+{
+  uint32_t budget = socket_manager->driver->config->drain_budget;
+  int nonblocking = _nonblocking(socket);
+
+  if((budget == 0 && !nonblocking) || socket->state != SOCKET_STATE_READY)
+    return;
+
+  // A nonblocking socket is read until the chip says it is empty,
+  // otherwise only a full read hints that more is waiting
+  if(data_length < socket->recv_length && !nonblocking)
+  {
+    // Short read, the socket is empty
+    socket->drain_bytes = 0;
+    return;
+  }
+
+  // A full read may also have emptied the socket exactly, and a
+  // blocking receive on an empty socket holds the chip until more data
+  // arrives. Those sockets are left to the next select.
+  if(!nonblocking && !_recv_timeout(socket))
+  {
+    socket->drain_bytes = 0;
+    return;
+  }
+
+  socket->readable = 1;
+  socket->drain_bytes += data_length;
+
+  if(budget > 0 && socket->drain_bytes >= budget)
+  {
+    socket->drain_bytes = 0;
+    return;
+  }
+
+  if(_socket_recv(socket_manager, socket))
+    socket_manager->driver->stats.drain_recvs++;
+}
+
 cc3k_status_t cc3k_select_event(cc3k_socket_manager_t *socket_manager, cc3k_select_event_t *ev)
 {
   cc3k_socket_t *socket;
+  cc3k_socket_t *first = NULL;
+  uint8_t events;
   int i;
 
   socket_manager->select_pending = 0;
@@ -133,15 +522,29 @@ cc3k_status_t cc3k_select_event(cc3k_socket_manager_t *socket_manager, cc3k_sele
   for(i=0;i<CC3K_MAX_SOCKETS;i++)
   {
     socket = socket_manager->socket[i];
-    if(socket == NULL)
+    if(socket == NULL || socket->state != SOCKET_STATE_READY)
       continue;
 
+    events = 0;
+
     if(ev->read_fd & (1<<(8-socket->sd)))
     {
       // Socket has data to read
       socket->readable = 1;
+      events |= CC3K_SOCKET_READABLE;
+      if(first == NULL)
+        first = socket;
+    }
+
+    else if(socket->rx_batch.active && socket->rx_batch.index > 0)
+    {
+      // The burst is over, hand over what has arrived so far
+      _batch_done(socket_manager, socket, &socket->rx_batch, CC3K_OK);
     }
 
+    if(ev->write_fd & (1<<(8-socket->sd)))
+      events |= CC3K_SOCKET_WRITABLE;
+
     if(ev->except_fd & (1<<(8-socket->sd)))
     {
       // Socket closed
@@ -149,10 +552,21 @@ cc3k_status_t cc3k_select_event(cc3k_socket_manager_t *socket_manager, cc3k_sele
       fprintf(stderr, "Socket %d closed\n", socket->sd);
 #endif
 
-      socket->state = SOCKET_STATE_INIT;
+      socket->state = socket->oneshot ? SOCKET_STATE_CLOSED : SOCKET_STATE_INIT;
+      events |= CC3K_SOCKET_CLOSED;
     }
+
+    _notify(socket_manager, socket, events);
   }  
 
+  // Fetch the data straight away instead of on the next loop pass.
+  // The select response is no longer needed, so the buffers can be reused.
+  if(first != NULL && first->readable && socket_manager->driver->config->chain_recv)
+  {
+    if(_socket_recv(socket_manager, first))
+      socket_manager->driver->stats.chained_recvs++;
+  }
+
   return CC3K_OK;
 }
 
@@ -160,33 +574,316 @@ cc3k_status_t cc3k_select_event(cc3k_socket_manager_t *socket_manager, cc3k_sele
 cc3k_status_t cc3k_socket_data_event(cc3k_socket_manager_t *socket_manager, int32_t sd, uint8_t *data, uint32_t data_length, cc3k_sockaddr_t *from)
 {
   cc3k_socket_t *socket;
+  cc3k_batch_t *batch;
+  cc3k_datagram_t *datagram;
 
   // Find the socket by descriptor
   _find_socket(socket_manager, sd, &socket);
 
   if(socket)
   {
-    socket->rx++;
-    socket->rx_bytes += data_length;
+    socket->stats.rx++;
+    socket->stats.rx_bytes += data_length;
+
+    batch = &socket->rx_batch;
+
+    if(batch->active)
+    {
+      // Fill the next entry of the batch
+      datagram = &batch->vec[batch->index++];
+      if(data_length < datagram->length)
+        datagram->length = data_length;
+      memcpy(datagram->data, data, datagram->length);
 
+      if(batch->index >= batch->count)
+        _batch_done(socket_manager, socket, batch, CC3K_OK);
+    }
     // If the socket has a reception callback set, call it
-    if(socket->receive_callback)
+    else if(socket->receive_callback)
       (socket->receive_callback)(socket_manager->driver, socket, data, data_length, from);
+    else
+      socket->stats.drops++;
+
+    _socket_drain(socket_manager, socket, data_length);
   }
+  else
+  {
+    socket_manager->driver->stats.rx_drops++;
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_recv_event(cc3k_socket_manager_t *socket_manager, int32_t sd, int32_t length)
+{
+  cc3k_socket_t *socket;
+
+  socket_manager->recv_timeout_ms = 0;
+
+  if(length > 0)
+    return CC3K_OK;
+
+  _find_socket(socket_manager, sd, &socket);
+  if(socket == NULL)
+    return CC3K_INVALID;
+
+  // Nothing was waiting, or the receive timed out
+  socket->readable = 0;
+  socket->drain_bytes = 0;
+
+  if(socket->rx_batch.active && socket->rx_batch.index > 0)
+    _batch_done(socket_manager, socket, &socket->rx_batch, CC3K_OK);
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_tx_event(cc3k_socket_manager_t *socket_manager, int32_t sd, uint32_t data_length)
+{
+  cc3k_socket_t *socket;
+
+  _find_socket(socket_manager, sd, &socket);
+  if(socket == NULL)
+    return CC3K_INVALID;
+
+  socket->stats.tx++;
+  socket->stats.tx_bytes += data_length;
 
   return CC3K_OK;
 }
 
-static void _socket_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, uint32_t dt)
+/**
+ * @brief Largest stream segment that fits the MSS and a chip buffer
+ */
+static uint16_t _segment_size(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  uint16_t buffer_size = socket_manager->driver->buffer_size;
+  uint16_t overhead;
+  uint16_t size = CC3K_SEND_MAX;
+
+  if(socket->mss > 0 && socket->mss < size)
+    size = socket->mss;
+
+  // The whole frame, headers and padding included, has to fit the buffer
+  overhead = sizeof(cc3k_spi_header_t) + sizeof(cc3k_data_header_t) + sizeof(cc3k_data_send_t) + 1;
+  if(buffer_size > overhead && buffer_size - overhead < size)
+    size = buffer_size - overhead;
+
+  return size;
+}
+
+static void _stream_done(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, cc3k_status_t status)
+{
+  cc3k_stream_t *stream = &socket->stream;
+
+  stream->active = 0;
+  stream->pending_length = 0;
+
+  if(socket_manager->streaming == socket)
+    socket_manager->streaming = NULL;
+
+  if(stream->done)
+    (*stream->done)(socket_manager->driver, socket, status, stream->sent);
+}
+
+/**
+ * @brief Send one frame of data on a socket, to its address if it is UDP
+ */
+static cc3k_status_t _socket_send(cc3k_t *driver, cc3k_socket_t *socket, uint8_t *data, uint16_t length)
+{
+  if(socket->type == SOCK_DGRAM)
+    return cc3k_sendto(driver, socket->sd, data, length, &socket->sockaddr);
+
+  return cc3k_send(driver, socket->sd, data, length);
+}
+
+static uint16_t _coalesce_capacity(cc3k_coalesce_t *coalesce)
+{
+  return coalesce->size < CC3K_SEND_MAX ? coalesce->size : CC3K_SEND_MAX;
+}
+
+static uint16_t _coalesce_threshold(cc3k_coalesce_t *coalesce)
+{
+  uint16_t capacity = _coalesce_capacity(coalesce);
+
+  if(coalesce->threshold == 0 || coalesce->threshold > capacity)
+    return capacity;
+
+  return coalesce->threshold;
+}
+
+/**
+ * @brief Send the waiting writes as one frame
+ *
+ * @return 1 if nothing is left waiting
+ */
+static int _coalesce_flush(cc3k_t *driver, cc3k_socket_t *socket)
+{
+  cc3k_coalesce_t *coalesce = &socket->coalesce;
+
+  if(coalesce->length == 0)
+    return 1;
+
+  if(_socket_send(driver, socket, coalesce->buffer, coalesce->length) != CC3K_OK)
+    return 0;
+
+  coalesce->length = 0;
+  coalesce->elapsed = 0;
+
+  return 1;
+}
+
+/**
+ * @brief Send the waiting writes once they are big enough or old enough
+ */
+static void _coalesce_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, uint32_t dt)
+{
+  cc3k_coalesce_t *coalesce = &socket->coalesce;
+
+  if(coalesce->length == 0)
+    return;
+
+  coalesce->elapsed += dt;
+
+  if(coalesce->elapsed >= coalesce->delay_ms || coalesce->length >= _coalesce_threshold(coalesce))
+    _coalesce_flush(socket_manager->driver, socket);
+}
+
+/**
+ * @brief Send the next segment of a socket's stream
+ *
+ * @return 1 if a segment was sent
+ */
+static int _stream_pump(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
+{
+  cc3k_stream_t *stream = &socket->stream;
+  uint16_t length;
+  int sent = 0;
+
+  // Earlier writes have to go out first, the loop sends them
+  if(!stream->active || stream->busy || socket->coalesce.length > 0)
+    return 0;
+
+  stream->busy = 1;
+
+  if(stream->pending_length == 0)
+  {
+    length = _segment_size(socket_manager, socket);
+
+    if(stream->pull)
+    {
+      length = (*stream->pull)(socket_manager->driver, socket, &stream->pending, length);
+    }
+    else
+    {
+      if(stream->length - stream->sent < length)
+        length = stream->length - stream->sent;
+      stream->pending = stream->data + stream->sent;
+    }
+
+    if(length == 0)
+    {
+      stream->busy = 0;
+      _stream_done(socket_manager, socket, CC3K_OK);
+      return 0;
+    }
+
+    stream->pending_length = length;
+  }
+
+  if(cc3k_send(socket_manager->driver, socket->sd, (uint8_t *)stream->pending, stream->pending_length) == CC3K_OK)
+  {
+    stream->sent += stream->pending_length;
+    stream->pending_length = 0;
+    socket_manager->streaming = socket;
+    sent = 1;
+  }
+
+  stream->busy = 0;
+
+  // A buffer is finished as soon as its last byte has gone out
+  if(sent && !stream->pull && stream->sent >= stream->length)
+    _stream_done(socket_manager, socket, CC3K_OK);
+
+  return sent;
+}
+
+/**
+ * @brief Send as many queued datagrams as the link and chip buffers allow
+ *
+ * @return Number of datagrams sent
+ */
+static int _batch_pump(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket)
 {
+  cc3k_batch_t *batch = &socket->tx_batch;
+  cc3k_datagram_t *datagram;
+  int sent = 0;
+
+  if(!batch->active || batch->busy)
+    return 0;
+
+  batch->busy = 1;
+
+  // With a blocking SPI transfer the frame is done by the time sendto
+  // returns, so keep going until the link or the buffers run out
+  while(batch->index < batch->count)
+  {
+    datagram = &batch->vec[batch->index];
+
+    if(cc3k_sendto(socket_manager->driver, socket->sd, datagram->data, datagram->length,
+      datagram->addr ? datagram->addr : &socket->sockaddr) != CC3K_OK)
+      break;
+
+    batch->index++;
+    socket_manager->streaming = socket;
+    sent++;
+  }
+
+  batch->busy = 0;
+
+  if(batch->index >= batch->count)
+    _batch_done(socket_manager, socket, batch, CC3K_OK);
+
+  return sent;
+}
+
+/**
+ * @brief Advance a socket's state machine
+ *
+ * @param issue Set if the socket may use the command slot on this pass
+ * @return 1 if a command was issued for the socket
+ */
+static int _socket_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t *socket, uint32_t dt, int issue)
+{
+  if(socket->remove && _remove_update(socket_manager, socket))
+    return 0;
+
+  // A stream cannot outlive the connection, however it was lost
+  if(socket->stream.active && socket->state != SOCKET_STATE_READY)
+    _stream_done(socket_manager, socket, CC3K_ERROR);
+
+  // Writes are only taken on a ready socket, and do not carry over
+  // to the next connection
+  if(socket->state != SOCKET_STATE_READY)
+    socket->coalesce.length = 0;
+
+  // Nor can a batch, or it would carry over to the recreated socket
+  if(socket->state != SOCKET_STATE_READY)
+  {
+    if(socket->tx_batch.active)
+      _batch_done(socket_manager, socket, &socket->tx_batch, CC3K_ERROR);
+    if(socket->rx_batch.active)
+      _batch_done(socket_manager, socket, &socket->rx_batch, CC3K_ERROR);
+  }
+
   switch(socket->state)
   {
     case SOCKET_STATE_INIT:
       // Ask the chip for a new socket
-      if(cc3k_socket(socket_manager->driver, socket->family, socket->type, socket->protocol) == CC3K_OK)
+      if(issue && cc3k_socket(socket_manager->driver, socket->family, socket->type, socket->protocol) == CC3K_OK)
       {
         socket_manager->current = socket;
         socket->state = SOCKET_STATE_CREATE;
+        return 1;
       }
       break;
     case SOCKET_STATE_CREATE:
@@ -195,23 +892,39 @@ static void _socket_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t
     case SOCKET_STATE_CREATED:
       // Socket descriptor is valid
 
+      // Options go to the chip before the socket is used
+      if(socket->options_pending)
+      {
+        if(issue && _socket_setopt(socket_manager, socket))
+          return 1;
+        break;
+      }
+
       // If this is a TCP client socket, connect to the endpoint
       if(socket->type == SOCK_STREAM && socket->bind == 0)
       { 
-        if(cc3k_connect(socket_manager->driver, socket->sd, &socket->sockaddr) == CC3K_OK)
+        if(issue && cc3k_connect(socket_manager->driver, socket->sd, &socket->sockaddr) == CC3K_OK)
         {
           socket_manager->current = socket;
           socket->state = SOCKET_STATE_CONNECTING;
+          return 1;
         }
       }
       else if(socket->type == SOCK_DGRAM && socket->bind == 1)
       {
-        if(cc3k_bind(socket_manager->driver, socket->sd, &socket->sockaddr) == CC3K_OK)
+        if(issue && cc3k_bind(socket_manager->driver, socket->sd, &socket->sockaddr) == CC3K_OK)
         {
           socket_manager->current = socket;
           socket->state = SOCKET_STATE_BINDING;
+          return 1;
         }
       }
+      else if(socket->type == SOCK_DGRAM)
+      {
+        // Unbound UDP sockets can send straight away
+        socket->state = SOCKET_STATE_READY;
+        _notify(socket_manager, socket, CC3K_SOCKET_CONNECTED);
+      }
       else
       {
         // No transition for this socket configuration
@@ -222,46 +935,77 @@ static void _socket_update(cc3k_socket_manager_t *socket_manager, cc3k_socket_t
     case SOCKET_STATE_CONNECTING:
       break;
     case SOCKET_STATE_READY:
-      if(socket->type == SOCK_STREAM && socket->readable)
+      // Data frames do not need the command slot
+      _coalesce_update(socket_manager, socket, dt);
+      _stream_pump(socket_manager, socket);
+      _batch_pump(socket_manager, socket);
+
+      // Learn the segment size of a new connection
+      if(issue && socket->type == SOCK_STREAM && !socket->mss_requested)
       {
-        cc3k_recv(socket_manager->driver, socket->sd, 1500);
-        socket->readable = 0;
+        if(cc3k_getmss(socket_manager->driver, socket->sd) == CC3K_OK)
+        {
+          socket_manager->current = socket;
+          socket->mss_requested = 1;
+          return 1;
+        }
       }
-      else if(socket->type == SOCK_DGRAM && socket->readable)
+
+      // Options set while the socket was open
+      if(issue && socket->options_pending && _socket_setopt(socket_manager, socket))
+        return 1;
+
+      if(issue && socket->readable)
+        return _socket_recv(socket_manager, socket);
+
+      // A socket with a receive timeout is read without a select, the
+      // chip holds the receive until data arrives. Such reads take turns
+      // with the select, or the other sockets would never be polled.
+      if(issue && _recv_timeout(socket) && !socket_manager->select_due &&
+        _socket_recv(socket_manager, socket))
       {
-        cc3k_recvfrom(socket_manager->driver, socket->sd, 1500);
-        socket->readable = 0;
+        socket_manager->select_due = 1;
+        return 1;
       }
       break;
     case SOCKET_STATE_FAILED:
-      if(dt >= socket->retry_timeout)
+      if(cc3k_backoff_elapsed(&socket->backoff, dt))
       {
         // Transition out
-        socket->retry_timeout = 0;
+        socket_manager->driver->stats.socket_retries++;
+        socket->stats.retries++;
         socket->state = SOCKET_STATE_INIT;
       } 
-      else
-      {
-        // Decrement time remaining
-        socket->retry_timeout -= dt;
-      }
+      break;
+    case SOCKET_STATE_CLOSED:
       break;
     case SOCKET_STATE_CLOSE_WAIT:
       // Close the socket
-      if(cc3k_close(socket_manager->driver, socket->sd) == CC3K_OK)
+      if(issue && cc3k_close(socket_manager->driver, socket->sd) == CC3K_OK)
       {
         socket_manager->current = socket;
         socket->state = SOCKET_STATE_CLOSING;
+        return 1;
       }
       break;
   } 
+
+  return 0;
 }
 
 cc3k_status_t cc3k_socket_manager_init(cc3k_t *driver, cc3k_socket_manager_t *socket_manager)
 {
+  int i;
+
   bzero(socket_manager, sizeof(cc3k_socket_manager_t));
 
   socket_manager->driver = driver;
+
+  // Hand out the lowest slots first
+  for(i=0;i<CC3K_MAX_SOCKETS;i++)
+    socket_manager->free_slots[i] = CC3K_MAX_SOCKETS - 1 - i;
+  socket_manager->num_free = CC3K_MAX_SOCKETS;
+
   return CC3K_OK;
 }
 
@@ -270,28 +1014,66 @@ cc3k_status_t cc3k_socket_manager_loop(cc3k_socket_manager_t *socket_manager, ui
   int i;
   cc3k_socket_t *socket;
 
+  cc3k_t *driver = socket_manager->driver;
+  int n;
+  int issued = 0;
+
   uint32_t rsd = 0;
   uint32_t wsd = 0;
   uint32_t esd = 0;
   uint8_t maxsd = 0;
   uint8_t count = 0;
 
-  // Update each of the registered sockets
-  for(i=0;i<CC3K_MAX_SOCKETS;i++)
+  // Descriptors the host lost track of in a reset are closed before any
+  // socket is opened, one per pass
+  if(socket_manager->stale != 0 && driver->state == CC3K_STATE_IDLE && driver->command == 0)
   {
+    for(i=0;(socket_manager->stale & (1<<i)) == 0;i++);
+
+    socket_manager->current = NULL;
+    if(cc3k_close(driver, i) == CC3K_OK)
+      socket_manager->stale &= ~(1<<i);
+    issued = 1;
+  }
+
+  // Update each of the registered sockets, starting where the last socket
+  // to use up its share of the command slot left off
+  for(n=0;n<CC3K_MAX_SOCKETS;n++)
+  {
+    i = (socket_manager->next + n) % CC3K_MAX_SOCKETS;
     socket = socket_manager->socket[i];
     if(socket == NULL)
       continue;
 
-    _socket_update(socket_manager, socket, dt);
+    if(_socket_update(socket_manager, socket, dt,
+      !issued && driver->state == CC3K_STATE_IDLE && driver->command == 0))
+    {
+      issued = 1;
+
+      // A socket with a weight of N gets N commands in a row before
+      // the next socket is served first
+      if(socket->credits == 0)
+        socket->credits = socket->weight > 0 ? socket->weight : 1;
+
+      if(--socket->credits == 0)
+        socket_manager->next = (i + 1) % CC3K_MAX_SOCKETS;
+      else
+        socket_manager->next = i;
+    }
+
+    if(!socket->registered)
+      continue;
 
     //if(socket_manager->select_pending == 0)
     //{
       if(socket->state == SOCKET_STATE_READY)
       {
         // Add the socket to the fd set for select
-        rsd |= (1<<socket->sd);
+        if(!_recv_timeout(socket))
+          rsd |= (1<<socket->sd);
         esd |= (1<<socket->sd);
+        if(socket->ready_mask & CC3K_SOCKET_WRITABLE)
+          wsd |= (1<<socket->sd);
 
         if(socket->sd > maxsd)
           maxsd = socket->sd;
@@ -301,12 +1083,15 @@ cc3k_status_t cc3k_socket_manager_loop(cc3k_socket_manager_t *socket_manager, ui
     //}
   } 
 
-  if(socket_manager->select_pending == 0)
+  if(socket_manager->select_pending == 0 && !issued)
   {
     if(count > 0)
     {
       if(cc3k_select(socket_manager->driver, maxsd+1, rsd, wsd, esd) == CC3K_OK)
+      {
         socket_manager->select_pending = 1;
+        socket_manager->select_due = 0;
+      }
     }
   }
 
@@ -315,27 +1100,217 @@ cc3k_status_t cc3k_socket_manager_loop(cc3k_socket_manager_t *socket_manager, ui
 
 cc3k_status_t cc3k_socket_add(cc3k_t *driver, cc3k_socket_t *socket)
 {
-  int i;
+  cc3k_socket_manager_t *socket_manager = &driver->socket_manager;
+  uint8_t slot;
+
+  if(socket->registered)
+    return CC3K_INVALID_STATE;
+
+  if(socket_manager->num_free == 0)
+    return CC3K_INVALID;
+
+  slot = socket_manager->free_slots[--socket_manager->num_free];
+
+  socket->slot = slot;
+  socket->remove = 0;
+  socket->registered = 1;
+  socket_manager->num_sockets++;
+
+  // Publish the socket last, the interrupt handlers walk this array
+  socket_manager->socket[slot] = socket;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_remove(cc3k_t *driver, cc3k_socket_t *socket)
+{
+  if(!socket->registered || driver->socket_manager.socket[socket->slot] != socket)
+    return CC3K_INVALID;
+
+  socket->remove = 1;
+
+  if(_remove_update(&driver->socket_manager, socket))
+    return CC3K_OK;
+
+  return CC3K_BUSY;
+}
+
+static cc3k_status_t _stream_start(cc3k_socket_t *socket, const uint8_t *data, uint32_t length,
+  cc3k_stream_pull_t *pull, cc3k_stream_done_t *done)
+{
+  cc3k_stream_t *stream = &socket->stream;
+
+  if(socket->type != SOCK_STREAM)
+    return CC3K_INVALID;
+
+  if(socket->state != SOCKET_STATE_READY)
+    return CC3K_INVALID_STATE;
+
+  if(stream->active)
+    return CC3K_BUSY;
+
+  stream->data = data;
+  stream->length = length;
+  stream->pull = pull;
+  stream->done = done;
+  stream->sent = 0;
+  stream->pending = NULL;
+  stream->pending_length = 0;
+  stream->busy = 0;
+
+  // Publish last, the interrupt path checks this flag
+  stream->active = 1;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_stream(cc3k_t *driver, cc3k_socket_t *socket, const uint8_t *data, uint32_t length, cc3k_stream_done_t *done)
+{
+  return _stream_start(socket, data, length, NULL, done);
+}
+
+cc3k_status_t cc3k_socket_stream_pull(cc3k_t *driver, cc3k_socket_t *socket, cc3k_stream_pull_t *pull, cc3k_stream_done_t *done)
+{
+  if(pull == NULL)
+    return CC3K_INVALID;
 
-  if(driver->socket_manager.num_sockets + 1 == CC3K_MAX_SOCKETS)
+  return _stream_start(socket, NULL, 0, pull, done);
+}
+
+static cc3k_status_t _batch_start(cc3k_socket_t *socket, cc3k_batch_t *batch,
+  cc3k_datagram_t *vec, uint16_t count, cc3k_batch_done_t *done)
+{
+  if(socket->type != SOCK_DGRAM || vec == NULL || count == 0)
     return CC3K_INVALID;
 
-  i = driver->socket_manager.num_sockets++;
+  if(socket->state != SOCKET_STATE_READY)
+    return CC3K_INVALID_STATE;
+
+  if(batch->active)
+    return CC3K_BUSY;
 
-  driver->socket_manager.socket[i] = socket;
+  batch->vec = vec;
+  batch->count = count;
+  batch->done = done;
+  batch->index = 0;
+  batch->busy = 0;
+
+  // Publish last, the interrupt path checks this flag
+  batch->active = 1;
 
   return CC3K_OK;
 }
 
-cc3k_status_t cc3k_socket_write(cc3k_socket_t *socket, uint8_t *data, int length)
+cc3k_status_t cc3k_socket_sendmmsg(cc3k_t *driver, cc3k_socket_t *socket, cc3k_datagram_t *vec, uint16_t count, cc3k_batch_done_t *done)
 {
-  switch(socket->type)  
+  uint16_t i;
+
+  // Refuse up front rather than stall the batch halfway
+  for(i=0;vec != NULL && i<count;i++)
   {
-    case SOCK_STREAM:
-      break;
-    case SOCK_DGRAM:
-      break;
+    if(vec[i].length > CC3K_SEND_MAX)
+      return CC3K_INVALID;
   }
+
+  return _batch_start(socket, &socket->tx_batch, vec, count, done);
+}
+
+cc3k_status_t cc3k_socket_recvmmsg(cc3k_t *driver, cc3k_socket_t *socket, cc3k_datagram_t *vec, uint16_t count, cc3k_batch_done_t *done)
+{
+  return _batch_start(socket, &socket->rx_batch, vec, count, done);
+}
+
+cc3k_status_t cc3k_socket_setopt(cc3k_socket_t *socket, uint32_t level, uint32_t optname, uint32_t value)
+{
+  if(level != SOL_SOCKET || optname >= CC3K_SOCKOPT_COUNT)
+    return CC3K_INVALID;
+
+  socket->options[optname] = value;
+  socket->options_set |= 1 << optname;
+
+  // Sent before connecting, or on the next pass if the socket is open
+  socket->options_pending |= 1 << optname;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_getopt(cc3k_socket_t *socket, uint32_t level, uint32_t optname, uint32_t *value)
+{
+  if(level != SOL_SOCKET || optname >= CC3K_SOCKOPT_COUNT)
+    return CC3K_INVALID;
+
+  if(socket->options_set & (1 << optname))
+    *value = socket->options[optname];
+  else if(optname == SOCKOPT_RECV_TIMEOUT)
+    *value = 0;
+  else
+    *value = SOCK_OFF;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_tx_done(cc3k_socket_manager_t *socket_manager)
+{
+  cc3k_socket_t *socket = socket_manager->streaming;
+
+  // Keep the chip buffers busy without waiting for the next loop pass
+  if(socket != NULL && socket->state == SOCKET_STATE_READY)
+  {
+    _stream_pump(socket_manager, socket);
+    _batch_pump(socket_manager, socket);
+  }
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_coalesce(cc3k_socket_t *socket, uint8_t *buffer, uint16_t size, uint16_t threshold, uint32_t delay_ms)
+{
+  cc3k_coalesce_t *coalesce = &socket->coalesce;
+
+  if(coalesce->length > 0)
+    return CC3K_BUSY;
+
+  coalesce->buffer = buffer;
+  coalesce->size = buffer != NULL ? size : 0;
+  coalesce->threshold = threshold;
+  coalesce->delay_ms = delay_ms;
+  coalesce->elapsed = 0;
+
+  return CC3K_OK;
+}
+
+cc3k_status_t cc3k_socket_write(cc3k_t *driver, cc3k_socket_t *socket, uint8_t *data, uint16_t length)
+{
+  cc3k_coalesce_t *coalesce = &socket->coalesce;
+
+  if(socket->state != SOCKET_STATE_READY)
+    return CC3K_INVALID_STATE;
+
+  // Keep the bytes behind a stream that is still going out
+  if(socket->stream.active)
+    return CC3K_BUSY;
+
+  if(coalesce->buffer == NULL)
+    return _socket_send(driver, socket, data, length);
+
+  // Make room, the oldest bytes go first
+  if(coalesce->length + length > _coalesce_capacity(coalesce) && !_coalesce_flush(driver, socket))
+    return CC3K_BUSY;
+
+  // Too big to be worth merging
+  if(length > _coalesce_capacity(coalesce))
+    return _socket_send(driver, socket, data, length);
+
+  if(coalesce->length == 0)
+    coalesce->elapsed = 0;
+
+  memcpy(coalesce->buffer + coalesce->length, data, length);
+  coalesce->length += length;
+
+  // If the link is busy the loop sends it shortly
+  if(coalesce->length >= _coalesce_threshold(coalesce))
+    _coalesce_flush(driver, socket);
+
   return CC3K_OK;
 }
 
@@ -0,0 +1,94 @@
+/**
+ * @file CC3K Driver statistics
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+#include <string.h>
+
+/**
+ * @brief Copy counters, retrying if an interrupt handler ran meanwhile
+ */
+static cc3k_status_t _snapshot(cc3k_t *driver, void *dst, const void *src, size_t length)
+{
+  uint32_t seq;
+  int i;
+
+  for(i=0;i<CC3K_STATS_SNAPSHOT_RETRIES;i++)
+  {
+    seq = driver->stats_seq;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    memcpy(dst, src, length);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(seq == driver->stats_seq)
+      return CC3K_OK;
+  }
+
+  return CC3K_BUSY;
+}
+
+/**
+ * @brief Scale the sum of the samples to a per second rate
+ */
+static uint32_t _rate(uint32_t total)
+{
+  return ((uint64_t)total * 1000) / CC3K_RATE_WINDOW_MS;
+}
+
+void cc3k_stats_update(cc3k_t *driver, uint32_t dt)
+{
+  cc3k_rate_window_t *window = &driver->rate_window;
+  cc3k_stats_t now;
+  uint32_t tx_bytes = 0;
+  uint32_t rx_bytes = 0;
+  uint32_t tx = 0;
+  uint32_t rx = 0;
+  int i;
+
+  window->elapsed += dt;
+  if(window->elapsed < CC3K_RATE_SAMPLE_MS)
+    return;
+
+  // Stalls longer than a sample are charged to a single sample
+  window->elapsed = 0;
+
+  if(_snapshot(driver, &now, &driver->stats, sizeof(cc3k_stats_t)) != CC3K_OK)
+    return;
+
+  i = window->index;
+  window->tx_bytes[i] = now.bytes_tx - window->last_tx_bytes;
+  window->rx_bytes[i] = now.bytes_rx - window->last_rx_bytes;
+  window->tx[i] = now.tx - window->last_tx;
+  window->rx[i] = now.rx - window->last_rx;
+  window->index = (i + 1) % CC3K_RATE_SAMPLES;
+
+  window->last_tx_bytes = now.bytes_tx;
+  window->last_rx_bytes = now.bytes_rx;
+  window->last_tx = now.tx;
+  window->last_rx = now.rx;
+
+  for(i=0;i<CC3K_RATE_SAMPLES;i++)
+  {
+    tx_bytes += window->tx_bytes[i];
+    rx_bytes += window->rx_bytes[i];
+    tx += window->tx[i];
+    rx += window->rx[i];
+  }
+
+  driver->stats.tx_bytes_per_sec = _rate(tx_bytes);
+  driver->stats.rx_bytes_per_sec = _rate(rx_bytes);
+  driver->stats.tx_frames_per_sec = _rate(tx);
+  driver->stats.rx_frames_per_sec = _rate(rx);
+}
+
+cc3k_status_t cc3k_stats_snapshot(cc3k_t *driver, cc3k_stats_t *stats)
+{
+  return _snapshot(driver, stats, &driver->stats, sizeof(cc3k_stats_t));
+}
+
+cc3k_status_t cc3k_socket_stats_snapshot(cc3k_t *driver, cc3k_socket_t *socket, cc3k_socket_stats_t *stats)
+{
+  return _snapshot(driver, stats, &socket->stats, sizeof(cc3k_socket_stats_t));
+}
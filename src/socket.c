@@ -0,0 +1,465 @@
+/**
+ * @file BSD socket layer
+ *
+ * Blocking socket calls on top of the asynchronous socket manager. Each
+ * call hands the work to a managed socket, then waits through the wait
+ * hook in the driver configuration until the socket manager is done.
+ * Received data is buffered per socket until recv is called.
+ */
+
+#include <stdlib.h>
+#include <cc3k.h>
+#include <socket.h>
+#include <string.h>
+
+/** @brief Number of BSD sockets that can be open at once */
+#ifndef CC3K_BSD_SOCKETS
+#define CC3K_BSD_SOCKETS CC3K_MAX_SOCKETS
+#endif
+
+/** @brief Receive buffer per BSD socket */
+#ifndef CC3K_BSD_RX_BUFFER
+#define CC3K_BSD_RX_BUFFER 1024
+#endif
+
+typedef struct _bsd_socket_t
+{
+  /** @brief Managed socket, must be the first member */
+  cc3k_socket_t socket;
+
+  /** @brief Slot is allocated to a descriptor */
+  uint8_t used;
+  /** @brief Socket has been asked to open on the chip */
+  uint8_t active;
+
+  /** @brief Default destination for send on a UDP socket */
+  cc3k_sockaddr_t peer;
+  uint8_t has_peer;
+
+  /**
+   * @brief Receive ring
+   *
+   * The indices run freely. The tail is only written by the receive
+   * callback and the head only by recv, so no locking is needed.
+   * UDP datagrams are stored with a two byte length prefix.
+   */
+  volatile uint32_t rx_head;
+  volatile uint32_t rx_tail;
+  uint8_t rx[CC3K_BSD_RX_BUFFER];
+} _bsd_socket_t;
+
+static cc3k_t *_driver;
+static _bsd_socket_t _sockets[CC3K_BSD_SOCKETS];
+
+static _bsd_socket_t *_get(int fd)
+{
+  if(_driver == NULL || fd < 0 || fd >= CC3K_BSD_SOCKETS)
+    return NULL;
+
+  if(!_sockets[fd].used)
+    return NULL;
+
+  return &_sockets[fd];
+}
+
+static int _wait(void)
+{
+  if(_driver->config->wait == NULL)
+    return -1;
+
+  (*_driver->config->wait)();
+  return 0;
+}
+
+static uint32_t _rx_space(_bsd_socket_t *s)
+{
+  return CC3K_BSD_RX_BUFFER - (s->rx_tail - s->rx_head);
+}
+
+static void _rx_write(_bsd_socket_t *s, uint32_t index, const uint8_t *data, uint32_t length)
+{
+  uint32_t offset = index % CC3K_BSD_RX_BUFFER;
+  uint32_t chunk = CC3K_BSD_RX_BUFFER - offset;
+
+  if(chunk > length)
+    chunk = length;
+
+  memcpy(s->rx + offset, data, chunk);
+  memcpy(s->rx, data + chunk, length - chunk);
+}
+
+static void _rx_read(_bsd_socket_t *s, uint32_t index, uint8_t *data, uint32_t length)
+{
+  uint32_t offset = index % CC3K_BSD_RX_BUFFER;
+  uint32_t chunk = CC3K_BSD_RX_BUFFER - offset;
+
+  if(chunk > length)
+    chunk = length;
+
+  memcpy(data, s->rx + offset, chunk);
+  memcpy(data + chunk, s->rx, length - chunk);
+}
+
+/**
+ * @brief Socket manager receive callback, queues data for recv
+ */
+static void _receive(cc3k_t *driver, cc3k_socket_t *socket, uint8_t *data, uint16_t length, cc3k_sockaddr_t *from)
+{
+  _bsd_socket_t *s = (_bsd_socket_t *)socket;
+  uint32_t space = _rx_space(s);
+  uint32_t tail = s->rx_tail;
+  uint16_t prefix;
+
+  if(socket->type == SOCK_DGRAM)
+  {
+    // Datagrams are kept whole, or dropped
+    if(space < (uint32_t)length + sizeof(uint16_t))
+    {
+      socket->stats.drops++;
+      return;
+    }
+
+    prefix = length;
+    _rx_write(s, tail, (uint8_t *)&prefix, sizeof(uint16_t));
+    tail += sizeof(uint16_t);
+  }
+  else if(length > space)
+  {
+    // The receive window should prevent this
+    socket->stats.drops++;
+    length = space;
+  }
+
+  _rx_write(s, tail, data, length);
+  s->rx_tail = tail + length;
+}
+
+/**
+ * @brief Socket manager receive window, limits reads to the free buffer space
+ */
+static uint16_t _window(cc3k_t *driver, cc3k_socket_t *socket)
+{
+  _bsd_socket_t *s = (_bsd_socket_t *)socket;
+  uint32_t space = _rx_space(s);
+
+  if(socket->type == SOCK_DGRAM)
+    space = space > sizeof(uint16_t) ? space - sizeof(uint16_t) : 0;
+
+  return space > 0xFFFF ? 0xFFFF : space;
+}
+
+/**
+ * @brief Open the socket on the chip and wait for it to become usable
+ */
+static int _activate(_bsd_socket_t *s)
+{
+  if(!s->active)
+  {
+    if(cc3k_socket_add(_driver, &s->socket) != CC3K_OK)
+      return -1;
+
+    s->active = 1;
+  }
+
+  while(s->socket.state != SOCKET_STATE_READY)
+  {
+    if(s->socket.state == SOCKET_STATE_CLOSED || s->socket.state == SOCKET_STATE_BOUND)
+      return -1;
+
+    if(_wait() != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+int cc3k_bsd_init(cc3k_t *driver)
+{
+  bzero(_sockets, sizeof(_sockets));
+  _driver = driver;
+  return 0;
+}
+
+int socket(int domain, int family, int protocol)
+{
+  _bsd_socket_t *s;
+  int fd;
+
+  if(_driver == NULL || domain != AF_INET)
+    return -1;
+
+  if(family != SOCK_STREAM && family != SOCK_DGRAM)
+    return -1;
+
+  for(fd=0;fd<CC3K_BSD_SOCKETS;fd++)
+  {
+    s = &_sockets[fd];
+    if(s->used)
+      continue;
+
+    cc3k_socket_init(&s->socket, family);
+    if(protocol != 0)
+      s->socket.protocol = protocol;
+    s->socket.oneshot = 1;
+    s->socket.receive_callback = _receive;
+    s->socket.receive_window = _window;
+
+    s->active = 0;
+    s->has_peer = 0;
+    s->rx_head = 0;
+    s->rx_tail = 0;
+    s->used = 1;
+
+    return fd;
+  }
+
+  return -1;
+}
+
+int bind(int socket, const sockaddr *address, socklen_t address_len)
+{
+  _bsd_socket_t *s = _get(socket);
+
+  if(s == NULL || s->active || address_len < sizeof(cc3k_sockaddr_t))
+    return -1;
+
+  // Listening sockets are not handled by the socket manager
+  if(s->socket.type != SOCK_DGRAM)
+    return -1;
+
+  cc3k_socket_bind(&s->socket, (cc3k_sockaddr_t *)address);
+
+  return _activate(s);
+}
+
+int connect(int socket, const sockaddr *address, socklen_t address_len)
+{
+  _bsd_socket_t *s = _get(socket);
+
+  if(s == NULL || address_len < sizeof(cc3k_sockaddr_t))
+    return -1;
+
+  if(s->socket.type == SOCK_DGRAM)
+  {
+    // Only sets the default destination
+    memcpy(&s->peer, address, sizeof(cc3k_sockaddr_t));
+    s->has_peer = 1;
+    return _activate(s);
+  }
+
+  if(s->active)
+    return -1;
+
+  memcpy(&s->socket.sockaddr, address, sizeof(cc3k_sockaddr_t));
+
+  return _activate(s);
+}
+
+int closesocket(int socket)
+{
+  _bsd_socket_t *s = _get(socket);
+
+  if(s == NULL)
+    return -1;
+
+  if(s->active && cc3k_socket_remove(_driver, &s->socket) == CC3K_BUSY)
+  {
+    // Wait for the chip to release the descriptor
+    while(s->socket.registered)
+    {
+      if(_wait() != 0)
+        return -1;
+    }
+  }
+
+  s->used = 0;
+  return 0;
+}
+
+static int _send(_bsd_socket_t *s, const void *buf, int len, cc3k_sockaddr_t *to)
+{
+  cc3k_status_t status;
+
+  if(len < 0)
+    return -1;
+
+  if(len > CC3K_SEND_MAX)
+    len = CC3K_SEND_MAX;
+
+  while(1)
+  {
+    if(s->socket.state != SOCKET_STATE_READY)
+      return -1;
+
+    if(to != NULL)
+      status = cc3k_sendto(_driver, s->socket.sd, (uint8_t *)buf, len, to);
+    else
+      status = cc3k_send(_driver, s->socket.sd, (uint8_t *)buf, len);
+
+    if(status == CC3K_OK)
+      return len;
+
+    if(status != CC3K_BUSY || _wait() != 0)
+      return -1;
+  }
+}
+
+int send(int socket, const void *buf, int len, int flags)
+{
+  _bsd_socket_t *s = _get(socket);
+
+  if(s == NULL || !s->active)
+    return -1;
+
+  if(s->socket.type == SOCK_DGRAM)
+  {
+    if(!s->has_peer)
+      return -1;
+    return _send(s, buf, len, &s->peer);
+  }
+
+  return _send(s, buf, len, NULL);
+}
+
+int sendto(int socket, const void *buf, int len, int flags,
+                  const sockaddr *to, socklen_t tolen)
+{
+  _bsd_socket_t *s = _get(socket);
+  cc3k_sockaddr_t sa;
+
+  if(s == NULL)
+    return -1;
+
+  if(s->socket.type != SOCK_DGRAM)
+    return send(socket, buf, len, flags);
+
+  if(to == NULL || tolen < sizeof(cc3k_sockaddr_t))
+    return -1;
+
+  memcpy(&sa, to, sizeof(cc3k_sockaddr_t));
+
+  if(_activate(s) != 0)
+    return -1;
+
+  return _send(s, buf, len, &sa);
+}
+
+int recv(int socket, void *buf, int len, int flags)
+{
+  _bsd_socket_t *s = _get(socket);
+  uint32_t head;
+  uint32_t available;
+  uint16_t length;
+
+  if(s == NULL || !s->active || len < 0)
+    return -1;
+
+  while(s->rx_tail == s->rx_head)
+  {
+    // Nothing buffered. A closed stream reads as end of file.
+    if(s->socket.state != SOCKET_STATE_READY)
+      return s->socket.type == SOCK_STREAM ? 0 : -1;
+
+    if(_wait() != 0)
+      return -1;
+  }
+
+  head = s->rx_head;
+  available = s->rx_tail - head;
+
+  if(s->socket.type == SOCK_DGRAM)
+  {
+    // One datagram per call, anything that does not fit is discarded
+    _rx_read(s, head, (uint8_t *)&length, sizeof(uint16_t));
+    head += sizeof(uint16_t);
+
+    if(len > length)
+      len = length;
+
+    _rx_read(s, head, buf, len);
+    s->rx_head = head + length;
+    return len;
+  }
+
+  if((uint32_t)len > available)
+    len = available;
+
+  _rx_read(s, head, buf, len);
+  s->rx_head = head + len;
+  return len;
+}
+
+int setsockopt(int socket, long level, long optname, const void *optval, socklen_t optlen)
+{
+  _bsd_socket_t *s = _get(socket);
+  uint32_t value = 0;
+
+  if(s == NULL || optval == NULL || optlen == 0 || optlen > sizeof(uint32_t))
+    return -1;
+
+  memcpy(&value, optval, optlen);
+
+  if(cc3k_socket_setopt(&s->socket, level, optname, value) != CC3K_OK)
+    return -1;
+
+  // A socket that is not open yet gets the option when it opens
+  if(!s->active)
+    return 0;
+
+  while(s->socket.options_pending & (1 << optname))
+  {
+    if(s->socket.state == SOCKET_STATE_CLOSED)
+      return -1;
+
+    if(_wait() != 0)
+      return -1;
+  }
+
+  return s->socket.option_result < 0 ? -1 : 0;
+}
+
+int getsockopt(int socket, long level, long optname, void *optval, socklen_t *optlen)
+{
+  _bsd_socket_t *s = _get(socket);
+  uint32_t value;
+
+  if(s == NULL || optval == NULL || optlen == NULL || *optlen < sizeof(uint32_t))
+    return -1;
+
+  if(cc3k_socket_getopt(&s->socket, level, optname, &value) != CC3K_OK)
+    return -1;
+
+  memcpy(optval, &value, sizeof(uint32_t));
+  *optlen = sizeof(uint32_t);
+  return 0;
+}
+
+int gethostbyname(char* hostname, int length, uint32_t* ip)
+{
+  cc3k_status_t status;
+
+  if(_driver == NULL || length < 0 || length > CC3K_HOSTNAME_MAX)
+    return -1;
+
+  // Wait for the command slot
+  while((status = cc3k_gethostbyname(_driver, hostname, length)) == CC3K_BUSY)
+  {
+    if(_wait() != 0)
+      return -1;
+  }
+
+  if(status != CC3K_OK)
+    return -1;
+
+  while(_driver->dns_pending)
+  {
+    if(_wait() != 0)
+      return -1;
+  }
+
+  if(_driver->dns_result < 0)
+    return -1;
+
+  *ip = _driver->dns_ip;
+  return 0;
+}